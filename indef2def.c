@@ -38,11 +38,33 @@
 
 /* 1. Includes */
 
+#define _GNU_SOURCE             /* fopencookie(), O_DIRECT, splice() */
+
 #include<stdio.h>
 #include<stdlib.h>
 #include<ctype.h>
 #include<string.h>
+#include<stdint.h>
+#include<time.h>
 #include<errno.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<sys/types.h>
+#include<sys/stat.h>
+#include<sys/wait.h>
+#include<sys/socket.h>
+#include<sys/un.h>
+#include<dirent.h>
+
+#ifdef __linux__
+    #include<sys/ioctl.h>
+    #include<sys/sendfile.h>
+    #include<linux/fs.h>            /* FICLONE */
+#endif
+
+#ifdef WITH_USDT
+    #include<sys/sdt.h>
+#endif
 
 
 /* 2. Defines */
@@ -52,6 +74,72 @@
     #define TRUE (!FALSE)
 #endif
 
+#define MAX_DEPTH   64          /* Default levels of nesting accepted */
+
+/*
+ * Static tracepoints (USDT), built with -DWITH_USDT and <sys/sdt.h>;
+ * otherwise they compile to nothing. Provider "indef2def":
+ *
+ *   pass__start   (pass, pos)                  pass 0: measuring items for -m,
+ *   pass__end     (pass, pos, out_pos)         1: collect_indef, 2: write_tap
+ *   collect__item (pos)                        top level item in collect_indef
+ *   write__item   (pos, out_pos)               top level item in write_tap
+ *   indef__len    (pos, out_pos, len_def)      indefinite length converted
+ *   flush         (fd, end)                    output before end written out of the buffer
+ *                                              of write_out, or under -p nocache|direct
+ *                                              synced or written as aligned blocks
+ *
+ * e.g. bpftrace -e 'usdt:./indef2def:indef2def:write__item { printf("%d\n", arg0); }'
+ */
+
+#ifdef WITH_USDT
+    #define PROBE1(name, a)             DTRACE_PROBE1(indef2def, name, a)
+    #define PROBE2(name, a, b)          DTRACE_PROBE2(indef2def, name, a, b)
+    #define PROBE3(name, a, b, c)       DTRACE_PROBE3(indef2def, name, a, b, c)
+#else
+    #define PROBE1(name, a)             do { } while (0)
+    #define PROBE2(name, a, b)          do { } while (0)
+    #define PROBE3(name, a, b, c)       do { } while (0)
+#endif
+
+#define CLASS_APPLICATION   1   /* Class of the tags of TAP and RAP */
+
+#define SCHEMA_ITEM     1       /* Any item of the schema */
+#define SCHEMA_ROOT     2       /* Item which starts a file */
+#define SCHEMA_RECORDS  3       /* List whose items are the records of the file */
+
+#define EVENT_JSON  0           /* TLV events as JSON Lines */
+#define EVENT_BIN   1           /* TLV events as binary records */
+
+#define CKPT_MAGIC      "indef2def-checkpoint 2"
+#define CKPT_INTERVAL   (64L*1024*1024)     /* Default input bytes between checkpoints */
+#define FNV_OFFSET      0xcbf29ce484222325ULL
+#define FNV_PRIME       0x100000001b3ULL
+
+#define IO_NORMAL       0                   /* stdio as it comes */
+#define IO_NOCACHE      1                   /* stdio, releasing the page cache behind us */
+#define IO_DIRECT       2                   /* O_DIRECT with aligned buffers */
+#define IO_ALIGN        4096                /* Alignment required by O_DIRECT */
+#define IO_DIRECT_BUF   (1024L*1024)        /* Default buffer for O_DIRECT */
+#define IO_ADVISE_CHUNK (16L*1024*1024)     /* Bytes between releases of the page cache */
+#define IO_COPY_BUF     65536               /* Chunk to copy primitive values */
+#define IO_OUT_BUF      65536               /* Default buffer of write_out */
+#define IO_SPLICE_MIN   IO_COPY_BUF         /* Shorter values are not worth a flush and a system call */
+#define IO_UNIX_PREFIX  "unix:"             /* Output to a Unix socket */
+
+#define CACHE_VERSION   2                   /* Part of the name of the entries of the cache:
+                                               bump it whenever the output of a conversion changes */
+#define CACHE_MAX       (1024L*1024*1024)   /* Default bytes kept in the output cache */
+#define CACHE_TMP_GRACE 3600                /* Seconds without a write after which an entry being stored was left behind */
+
+#if defined(__GLIBC__) && defined(O_DIRECT)
+    #define IO_HAVE_DIRECT
+#endif
+
+#if defined(__linux__) && defined(SPLICE_F_MOVE)
+    #define IO_HAVE_SPLICE
+#endif
+
 
 /* 3. Typedefs and structures */
 
@@ -62,11 +150,9 @@ typedef struct _asn1item
     unsigned    pc: 1;          /* Primitive/Constructed */
     int         tag;            /* Tag: decimal format */
     uchar       tag_x[4];       /* Tag: bcd format */
-    char        tag_h[9];       /* Tag: hexadecimal string format */
     int         tag_l;          /* Tag: number of bytes in file */
     long        size;           /* Size: decimal format */
     uchar       size_x[8];      /* Size: bcd format */
-    char        size_h[17];     /* Size: hexadecimal format */
     int         size_l;         /* Size: number of bytes in file */
 } asn1item;
 
@@ -79,63 +165,423 @@ typedef struct _indef_len_item
 } indef_len_item;
 
 
+typedef struct _event_opts
+{
+    FILE*       file;           /* Where to write the TLV events. NULL: no events */
+    int         format;         /* EVENT_JSON or EVENT_BIN */
+    int         depth;          /* Deepest level to report. -1: all levels */
+    int         values;         /* Report also the value of primitive items */
+    int         in_value;       /* The value of the current item is being written */
+} event_opts;
+
+
+typedef struct _ckpt_state
+{
+    char*       filename;       /* Checkpoint file. NULL: no checkpoints */
+    char*       tbl_filename;   /* Where the list of indefinite length is saved */
+    long        interval;       /* Input bytes between checkpoints */
+    long        last_pos;       /* Input position of the last checkpoint */
+    long        consumed;       /* Items of the list of indefinite length already written */
+    long        ev_pos;         /* Position in the event file */
+    unsigned long long out_hash;    /* FNV-1a of the output written so far */
+    long*       frames;         /* Size left in each open constructed item after its value */
+    int         frames_max;     /* Allocated frames */
+    int         resume_depth;   /* Open constructed items to reopen when resuming. -1: not resuming */
+    long        resume_size;    /* Size left at the deepest level when resuming */
+    char        in_id[96];      /* Device, inode, modification and change times of the input */
+} ckpt_state;
+
+
+typedef struct _io_file
+{
+    FILE*       file;           /* Stream used by the rest of the program */
+    int         fd;             /* Descriptor behind the stream */
+    char*       vbuf;           /* Buffer given to setvbuf() */
+    int         writing;        /* Opened for writing */
+    long        advised;        /* IO_NOCACHE: bytes already released from the page cache */
+    uchar*      buf;            /* IO_DIRECT: aligned buffer */
+    size_t      buf_len;        /* IO_DIRECT: valid bytes in buf */
+    off_t       buf_off;        /* IO_DIRECT: position of buf in the file. -1: nothing loaded */
+    off_t       off;            /* IO_DIRECT: current position */
+    off_t       end;            /* IO_DIRECT: size of the file */
+    int         dirty;          /* IO_DIRECT: buf has to be written */
+    int         stream;         /* Standard output, pipe or socket: no seeking */
+    int         pipe;           /* A pipe, for splice() */
+    struct _io_file *next;
+} io_file;
+
+typedef struct _io_opts
+{
+    int         mode;           /* IO_NORMAL, IO_NOCACHE or IO_DIRECT */
+    size_t      bufsize;        /* Buffer of each file. 0: default */
+    io_file*    files;          /* Files opened with io_open() */
+    int         splice;         /* Values moved by the kernel into streams */
+    uchar*      out_buf;        /* Buffer of write_out */
+    size_t      out_size;       /* Its size: io.bufsize, or IO_OUT_BUF */
+    size_t      out_len;        /* Bytes in it not written yet */
+} io_opts;
+
+
+typedef struct _sha256_ctx
+{
+    uint32_t            state[8];       /* Hash so far */
+    unsigned long long  len;            /* Bytes added */
+    uchar               block[64];      /* Block being filled */
+    size_t              used;           /* Bytes in block */
+} sha256_ctx;
+
+typedef struct _cache_opts
+{
+    char*       dir;            /* Cache of converted files. NULL: no cache */
+    long        max;            /* Bytes kept in the cache */
+    int         link;           /* Serve hits as hard links to the cache */
+    char*       entry;          /* Entry of the input file */
+} cache_opts;
+
+
+typedef struct _schema_tag
+{
+    const char* name;           /* Name in the specification. NULL: tag not known */
+    uchar       pc;             /* Primitive/Constructed */
+    uchar       kind;           /* SCHEMA_ITEM, SCHEMA_ROOT or SCHEMA_RECORDS */
+} schema_tag;
+
+typedef struct _schema_def
+{
+    const char*         name;   /* As given in the command line */
+    const schema_tag*   tags;   /* Indexed by the number of APPLICATION tag */
+    int                 size;   /* Number of tags */
+} schema_def;
+
+
+typedef struct _top_item
+{
+    long        pos;            /* Position into the input file */
+    long        out_pos;        /* Position into the output file, once converted */
+} top_item;
+
+
 /* 4. Prototypes */
 
 int     write_tap       (FILE *file, FILE *outfile, long size, indef_len_item **len_list);
 int     decode_size     (FILE *file, asn1item *a_item);
 int     decode_tag      (FILE *file, asn1item *a_item);
-int     collect_indef   (FILE *file, long size, indef_len_item *len_list, long *len, long *len_def);
+int     collect_indef   (FILE *file, long size, indef_len_item **len_tail, long *len, long *len_def);
 void    bcd_2_hexa      (char *str2, const uchar *str1, const int len);
-int     encode_size     (uchar *size2,int size1, int *len);
+int     encode_size     (uchar *size2,long size1, int *len);
 
 void    dump_indef      (indef_len_item* len_list);
+void    usage           (const char *prog);
+
+int     event_begin     (const asn1item *a_item, const schema_tag *s_tag, long in_pos, long in_len, int indef);
+void    event_value     (uchar value);
+void    event_end       (void);
+
+int     multi_convert   (FILE *file, const char *inFilename, const char *outFilename);
+int     convert_item    (const char *inFilename, const char *outFilename, int n, const top_item *t_item);
+
+const schema_tag* schema_lookup (const asn1item *a_item);
+int     schema_check    (const asn1item *a_item, const schema_tag *s_tag);
+
+void    write_out       (FILE *outfile, const uchar *buf, long len);
+int     write_flush     (FILE *outfile);
+int     ckpt_read       (void);
+int     ckpt_write      (FILE *outfile, long size);
+int     ckpt_reopen     (const char *filename, long len, int verify);
+int     ckpt_push       (long size_after);
+int     table_save      (indef_len_item *len_list);
+indef_len_item* table_load (long skip);
+
+FILE*   io_open         (const char *filename, const char *mode);
+int     io_close        (FILE *f);
+int     io_sync         (FILE *f);
+void    io_advise       (FILE *f, long len);
+io_file* io_find        (FILE *f);
+ssize_t io_direct_read  (void *cookie, char *buf, size_t size);
+ssize_t io_direct_write (void *cookie, const char *buf, size_t size);
+int     io_direct_seek  (void *cookie, off64_t *offset, int whence);
+int     io_direct_close (void *cookie);
+int     io_direct_flush (io_file *io);
+void    io_unshare      (const char *filename);
+int     io_is_stream    (const char *filename);
+int     io_connect      (const char *filename);
+long    io_splice       (FILE *file, FILE *outfile, long from, long len);
+
+void    sha256_init     (sha256_ctx *ctx);
+void    sha256_block    (sha256_ctx *ctx, const uchar *block);
+void    sha256_update   (sha256_ctx *ctx, const uchar *buf, size_t len);
+void    sha256_final    (sha256_ctx *ctx, char *hex);
+
+int     cache_lookup    (FILE *file, const char *outFilename);
+void    cache_store     (const char *outFilename);
+int     cache_copy      (const char *src, const char *dst, int hardlink, int durable);
+void    cache_evict     (void);
+
+/* 5. Schema tables
+ *
+ * APPLICATION tags of TAP 3.x (TD.57) and RAP (TD.32) which give the
+ * structure of the files: where they start, where the records are and
+ * which items are constructed. Tags not listed are decoded as usual,
+ * without any check.
+ *
+ * Each list expands to a table indexed by tag number, so that looking up
+ * a tag is a single access.
+ */
+
+#define TAP_TAGS(T) \
+    T(   1, 1, SCHEMA_ROOT,     "TransferBatch"                 ) \
+    T(   2, 1, SCHEMA_ROOT,     "Notification"                  ) \
+    T(   3, 1, SCHEMA_RECORDS,  "CallEventDetailList"           ) \
+    T(   4, 1, SCHEMA_ITEM,     "BatchControlInfo"              ) \
+    T(   5, 1, SCHEMA_ITEM,     "AccountingInfo"                ) \
+    T(   6, 1, SCHEMA_ITEM,     "NetworkInfo"                   ) \
+    T(   8, 1, SCHEMA_ITEM,     "MessageDescriptionInfoList"    ) \
+    T(  15, 1, SCHEMA_ITEM,     "AuditControlInfo"              ) \
+    TAP_CALL_TAGS(T)
+
+/* Call events: records of TAP, also returned within RAP */
+
+#define TAP_CALL_TAGS(T) \
+    T(   9, 1, SCHEMA_ITEM,     "MobileOriginatedCall"          ) \
+    T(  10, 1, SCHEMA_ITEM,     "MobileTerminatedCall"          ) \
+    T(  11, 1, SCHEMA_ITEM,     "SupplServiceEvent"             ) \
+    T(  12, 1, SCHEMA_ITEM,     "ServiceCentreUsage"            ) \
+    T(  14, 1, SCHEMA_ITEM,     "GprsCall"                      ) \
+    T(  17, 1, SCHEMA_ITEM,     "ContentTransaction"            ) \
+    T( 297, 1, SCHEMA_ITEM,     "LocationService"               ) \
+    T( 433, 1, SCHEMA_ITEM,     "MessagingEvent"                ) \
+    T( 434, 1, SCHEMA_ITEM,     "MobileSession"                 )
+
+#define RAP_TAGS(T) \
+    T( 534, 1, SCHEMA_ROOT,     "ReturnBatch"                   ) \
+    T( 535, 1, SCHEMA_ROOT,     "Acknowledgement"               ) \
+    T( 536, 1, SCHEMA_RECORDS,  "ReturnDetailList"              ) \
+    T( 537, 1, SCHEMA_ITEM,     "RapBatchControlInfo"           ) \
+    T( 541, 1, SCHEMA_ITEM,     "RapAuditControlInfo"           ) \
+    TAP_CALL_TAGS(T)
+
+#define SCHEMA_TAG(tag, pc, kind, name)     [tag]={ name, pc, kind },
+
+const schema_tag tap_tags[435]={ TAP_TAGS(SCHEMA_TAG) };
+const schema_tag rap_tags[542]={ RAP_TAGS(SCHEMA_TAG) };
+
+const schema_def schemas[]=
+{
+    { "tap", tap_tags, sizeof(tap_tags)/sizeof(tap_tags[0]) },
+    { "rap", rap_tags, sizeof(rap_tags)/sizeof(rap_tags[0]) },
+    { NULL,  NULL,     0 }
+};
 
-/* 5. Global Variables */
+
+/* 6. Global Variables */
 
 long pos=0;         /* Current position in file. */
+long out_pos=0;     /* Current position in output file. */
+int  depth=0;       /* Current nesting level in write_tap */
 int  all_file=0;    /* Converts all file */
+long in_size=0;     /* Size of the input file */
+int  max_depth=MAX_DEPTH;   /* Levels of nesting accepted */
+long max_items=0;   /* Items accepted. 0: no limit */
+long items=0;       /* Items found */
+
+const schema_def* schema=NULL;  /* Schema to check the file against. NULL: none */
+int  records_depth=-1;          /* Level of the list of records. -1: not inside */
+long record_no=0;               /* Records found */
+
+int  jobs=0;        /* Top level items converted in parallel. 0: whole file at once */
+int  split=FALSE;   /* Each top level item into its own output file */
+
+event_opts events={ NULL, EVENT_JSON, -1, FALSE, FALSE };     /* TLV event stream */
+
+ckpt_state ckpt={ NULL, NULL, CKPT_INTERVAL, 0, 0, 0, FNV_OFFSET, NULL, 0, -1, 0, "" };    /* Checkpoints */
+
+io_opts io={ IO_NORMAL, 0, NULL, TRUE, NULL, 0, 0 };     /* I/O policy */
+
+uchar copy_buf[IO_COPY_BUF];            /* To copy primitive values */
+
+cache_opts cache={ NULL, CACHE_MAX, FALSE, NULL };     /* Cache of converted files */
 
 
 int main(int argc, char **argv)
 {
     FILE*               file, *outfile;
-    char*               inFilename, *outFilename;
-    indef_len_item*     len_list;
+    char*               inFilename, *outFilename, *evFilename=NULL;
+    char*               prog=argv[0];
+    indef_len_item*     len_list, *len_tail;
     long                len_tmp=0, len_def_tmp=0;
     long                size=0;
+    int                 resume=FALSE;
+    int                 hit, out_stream;
+    struct stat         in_st;
 
 
     /* 1. Checking parameters */
 
-    if (argc != 3 && argc != 4)
+    while (argc > 1 && argv[1][0] == '-' && argv[1][1])
+    {
+        if (strcmp(argv[1], "-a") == 0)
+        {
+            all_file = 1;
+        }
+        else if (strcmp(argv[1], "-v") == 0)
+        {
+            events.values = TRUE;
+        }
+        else if (strcmp(argv[1], "-x") == 0)
+        {
+            split = TRUE;
+        }
+        else if (strcmp(argv[1], "-L") == 0)
+        {
+            cache.link = TRUE;
+        }
+        else if (strcmp(argv[1], "-m") == 0 && argc > 2)
+        {
+            if ( ( jobs = atoi(argv[2]) ) <= 0 )
+                usage(prog);
+            argv++; argc--;
+        }
+        else if (strcmp(argv[1], "-e") == 0 && argc > 2)
+        {
+            evFilename = argv[2];
+            argv++; argc--;
+        }
+        else if (strcmp(argv[1], "-f") == 0 && argc > 2)
+        {
+            if (strcmp(argv[2], "json") == 0)
+                events.format = EVENT_JSON;
+            else if (strcmp(argv[2], "bin") == 0)
+                events.format = EVENT_BIN;
+            else
+                usage(prog);
+            argv++; argc--;
+        }
+        else if (strcmp(argv[1], "-l") == 0 && argc > 2)
+        {
+            events.depth = atoi(argv[2]);
+            argv++; argc--;
+        }
+        else if (strcmp(argv[1], "-c") == 0 && argc > 2)
+        {
+            ckpt.filename = argv[2];
+            argv++; argc--;
+        }
+        else if (strcmp(argv[1], "-i") == 0 && argc > 2)
+        {
+            if ( ( ckpt.interval = atol(argv[2]) ) <= 0 )
+                usage(prog);
+            argv++; argc--;
+        }
+        else if (strcmp(argv[1], "-D") == 0 && argc > 2)
+        {
+            if ( ( max_depth = atoi(argv[2]) ) <= 0 )
+                usage(prog);
+            argv++; argc--;
+        }
+        else if (strcmp(argv[1], "-N") == 0 && argc > 2)
+        {
+            if ( ( max_items = atol(argv[2]) ) <= 0 )
+                usage(prog);
+            argv++; argc--;
+        }
+        else if (strcmp(argv[1], "-s") == 0 && argc > 2)
+        {
+            for (schema=schemas; schema->name && strcmp(schema->name, argv[2]) != 0; schema++)
+                ;
+            if (!schema->name)
+                usage(prog);
+            argv++; argc--;
+        }
+        else if (strcmp(argv[1], "-p") == 0 && argc > 2)
+        {
+            if (strcmp(argv[2], "normal") == 0)
+                io.mode = IO_NORMAL;
+            else if (strcmp(argv[2], "nocache") == 0)
+                io.mode = IO_NOCACHE;
+            else if (strcmp(argv[2], "direct") == 0)
+                io.mode = IO_DIRECT;
+            else
+                usage(prog);
+            argv++; argc--;
+        }
+        else if (strcmp(argv[1], "-b") == 0 && argc > 2)
+        {
+            if ( atol(argv[2]) <= 0 )
+                usage(prog);
+            io.bufsize = (size_t)atol(argv[2]);
+            argv++; argc--;
+        }
+        else if (strcmp(argv[1], "-k") == 0 && argc > 2)
+        {
+            cache.dir = argv[2];
+            argv++; argc--;
+        }
+        else if (strcmp(argv[1], "-K") == 0 && argc > 2)
+        {
+            if ( ( cache.max = atol(argv[2]) ) <= 0 )
+                usage(prog);
+            argv++; argc--;
+        }
+        else
+        {
+            usage(prog);
+        }
+        argv++; argc--;
+    }
+
+    if (argc != 3)
+        usage(prog);
+
+    if ( split && !jobs )
+        usage(prog);
+
+    if ( cache.link && !cache.dir )
+        usage(prog);
+
+    if ( split )
+    {
+        /* The cache keeps one output per input */
+        cache.dir = NULL;
+    }
+
+    if ( jobs && ( evFilename || ckpt.filename ) )
     {
-        fprintf(stderr, "Copyright (c) 2007-2018 Javier Gutierrez. (https://github.com/tap3edit/indef2def)\n");
-        fprintf(stderr, "Usage: %s [ -a ] infilename outfilename\n", argv[0]);
-        fprintf(stderr, "   -a : converts all file\n");
+        fprintf(stderr, "-m cannot be combined with -e or -c\n");
         exit(1);
     }
 
-    if (strcmp(argv[1], "-a") == 0)
+    if ( jobs && !split && io.mode == IO_DIRECT )
     {
-        all_file = 1;
-        argv++;
+        /* Neighbour items could share a block of the output */
+        fprintf(stderr, "-m with -p direct needs -x\n");
+        exit(1);
+    }
+
+#ifndef IO_HAVE_DIRECT
+    if (io.mode == IO_DIRECT)
+    {
+        fprintf(stderr, "O_DIRECT is not supported on this system\n");
+        exit(1);
     }
+#endif
 
     inFilename=argv[1];
     outFilename=argv[2];
+    out_stream=io_is_stream(outFilename);
 
-
-    /* 2. Open Input Files */
-    
-    if ( ( file=fopen(inFilename, "rb") ) == NULL )
+    if ( out_stream && ( jobs || ckpt.filename ) )
     {
-        fprintf(stderr, "Cannot open file %s\n", inFilename);
+        /* Both write the output at given positions */
+        fprintf(stderr, "-m and -c need outfilename to be a regular file\n");
         exit(1);
     }
 
-    if ( ( outfile=fopen(outFilename, "wb") ) == NULL )
+
+    /* 2. Open Input Files */
+    
+    if ( ( file=io_open(inFilename, "rb") ) == NULL )
     {
-        fprintf(stderr, "Cannot open file %s\n", outFilename);
+        fprintf(stderr, "Cannot open file %s\n", inFilename);
         exit(1);
     }
 
@@ -147,7 +593,7 @@ int main(int argc, char **argv)
         fprintf(stderr, "Error moving to the end of the file: %s\n", strerror(errno));
         exit(1);
     }
-    size = ftell(file); // get current file pointer
+    in_size = size = ftell(file); // get current file pointer
     if (fseek(file, 0, SEEK_SET) != 0) // seek back to beginning of file
     {
         fprintf(stderr, "Error moving to the beginning of the file: %s\n", strerror(errno));
@@ -155,27 +601,160 @@ int main(int argc, char **argv)
     }
 
 
-    /* 4. Find all indefinite lengths */
+    /* 3.1. Converted before: take it from the cache. The events need the decoding anyway */
 
-    if ( ( len_list=(indef_len_item*)malloc(sizeof(indef_len_item)) ) == NULL )
+    if ( cache.dir && !evFilename && ( hit=cache_lookup(file, outFilename) ) != FALSE )
     {
-        fprintf(stderr, "Problems allocating memory\n");
-        exit(1);
+        if (hit == -1)
+            exit(1);
+
+        io_close(file);
+
+        return(EXIT_SUCCESS);
     }
-    memset(len_list, 0x00, sizeof(indef_len_item));
 
-    if (collect_indef(file,all_file?size:-1, len_list, &len_tmp, &len_def_tmp) == -1 )
+
+    /* 3.2. Top level items on their own */
+
+    if (jobs)
     {
-        fprintf(stderr, "Error decoding file\n");
-        exit(1);
+        if ( multi_convert(file, inFilename, outFilename) == -1 )
+        {
+            fprintf(stderr, "Error decoding file\n");
+            exit(1);
+        }
+
+        io_close(file);
+
+        if (cache.dir)
+            cache_store(outFilename);
+
+        return(EXIT_SUCCESS);
+    }
+
+
+    /* 4. Look for a checkpoint of a previous run */
+
+    if (ckpt.filename)
+    {
+
+        if ( ( ckpt.tbl_filename=(char*)malloc(strlen(ckpt.filename)+5) ) == NULL )
+        {
+            fprintf(stderr, "Problems allocating memory\n");
+            exit(1);
+        }
+        sprintf(ckpt.tbl_filename, "%s.tbl", ckpt.filename);
+
+        /* A file delivered again, even of the same size, must not resume the old run */
+
+        if ( fstat(io_find(file)->fd, &in_st) != 0 )
+        {
+            fprintf(stderr, "Cannot get the status of file %s: %s\n", inFilename, strerror(errno));
+            exit(1);
+        }
+        sprintf(ckpt.in_id, "%lx:%lx:%ld.%09ld:%ld.%09ld", (unsigned long)in_st.st_dev, (unsigned long)in_st.st_ino,
+                (long)in_st.st_mtim.tv_sec, (long)in_st.st_mtim.tv_nsec, (long)in_st.st_ctim.tv_sec, (long)in_st.st_ctim.tv_nsec);
+
+        if ( ( resume=ckpt_read() ) == -1 )
+            exit(1);
+    }
+
+
+    /* 5. Open Output Files */
+
+    if (resume)
+    {
+        /* 5.1. Continue where the checkpoint was taken */
+
+        if ( ckpt_reopen(outFilename, out_pos, TRUE) == -1 )
+            exit(1);
+
+        if ( ( outfile=io_open(outFilename, "r+b") ) == NULL || fseek(outfile, out_pos, SEEK_SET) != 0 )
+        {
+            fprintf(stderr, "Cannot open file %s\n", outFilename);
+            exit(1);
+        }
+
+        if ( evFilename && ckpt_reopen(evFilename, ckpt.ev_pos, FALSE) == -1 )
+            exit(1);
+
+        if ( evFilename && ( ( events.file=fopen(evFilename, "r+b") ) == NULL || fseek(events.file, ckpt.ev_pos, SEEK_SET) != 0 ) )
+        {
+            fprintf(stderr, "Cannot open file %s\n", evFilename);
+            exit(1);
+        }
+    }
+    else
+    {
+        /* 5.2. Start from the beginning */
+
+        if ( ( outfile=io_open(outFilename, "wb") ) == NULL )
+        {
+            fprintf(stderr, "Cannot open file %s\n", outFilename);
+            exit(1);
+        }
+
+        if ( evFilename && ( events.file=fopen(evFilename, "wb") ) == NULL )
+        {
+            fprintf(stderr, "Cannot open file %s\n", evFilename);
+            exit(1);
+        }
+    }
+
+
+    /* 6. Find all indefinite lengths */
+
+    if (resume)
+    {
+        /* 6.1. Already found by the previous run */
+
+        if ( ( len_list=table_load(ckpt.consumed) ) == NULL )
+            exit(1);
+
+        if (fseek(file, pos, SEEK_SET) != 0)
+        {
+            fprintf(stderr, "Error moving to the position %ld of the file: %s\n", pos, strerror(errno));
+            exit(1);
+        }
     }
+    else
+    {
+        if ( ( len_list=(indef_len_item*)malloc(sizeof(indef_len_item)) ) == NULL )
+        {
+            fprintf(stderr, "Problems allocating memory\n");
+            exit(1);
+        }
+        memset(len_list, 0x00, sizeof(indef_len_item));
+
+        len_tail=len_list;
+
+        PROBE2(pass__start, 1, pos);
+
+        if (collect_indef(file,all_file?size:-1, &len_tail, &len_tmp, &len_def_tmp) == -1 )
+        {
+            fprintf(stderr, "Error decoding file\n");
+            exit(1);
+        }
+
+        PROBE3(pass__end, 1, pos, 0);
+
+        pos=0;
+        records_depth=-1;
+        record_no=0;
 
+        rewind(file);
+
+
+        /* 6.2. Save them with a first checkpoint, so that a rerun can skip this pass */
+
+        if ( ckpt.filename && ( table_save(len_list) == -1 || ckpt_write(outfile, all_file?size:1) == -1 ) )
+            exit(1);
+    }
 
-    /* 5. Decode and prints file */
 
-    pos=0;
+    /* 7. Decode and prints file */
 
-    rewind(file);
+    PROBE2(pass__start, 2, pos);
 
     if ( (write_tap(file,outfile,all_file?size:1,&len_list) )==-1 )
     {
@@ -183,19 +762,91 @@ int main(int argc, char **argv)
         exit(1);
     }
 
+    PROBE3(pass__end, 2, pos, out_pos);
 
-    /* 6. Closing and End. */
+
+    /* 8. Closing and End. */
     if (len_list)
     {
         free(len_list);
     }
 
-    fclose(file);
-    fclose(outfile);
+    io_close(file);
+
+    if ( write_flush(outfile) != 0 || io_close(outfile) != 0 )
+    {
+        fprintf(stderr, "Error writing file %s: %s\n", outFilename, strerror(errno));
+        exit(1);
+    }
+
+    if (events.file && fclose(events.file) != 0)
+    {
+        fprintf(stderr, "Error writing file %s: %s\n", evFilename, strerror(errno));
+        exit(1);
+    }
+
+    if (ckpt.filename)
+    {
+        /* 8.1. Conversion completed: the checkpoint is not needed anymore */
+
+        remove(ckpt.filename);
+        remove(ckpt.tbl_filename);
+        free(ckpt.tbl_filename);
+        free(ckpt.frames);
+    }
+
+    if ( cache.dir && !out_stream )
+    {
+        /* 8.2. Keep the output for the next conversion of the same input. A stream cannot be read back */
+
+        cache_store(outFilename);
+    }
 
     return(EXIT_SUCCESS);
 }
 
+
+/****************************************************************************
+|* 
+|* Function: usage
+|* 
+|* Description; 
+|* 
+|*     Prints the command line help and leaves
+|* 
+|* Return:
+|*      Does not return
+|* 
+****************************************************************************/
+void usage(
+    const char*         prog            /* Name of the program */
+)
+{
+    fprintf(stderr, "Copyright (c) 2007-2018 Javier Gutierrez. (https://github.com/tap3edit/indef2def)\n");
+    fprintf(stderr, "Usage: %s [ -a ] [ -e evfilename [ -f json|bin ] [ -l depth ] [ -v ] ] [ -c ckptfilename [ -i bytes ] ]\n", prog);
+    fprintf(stderr, "       [ -p normal|nocache|direct ] [ -b bufsize ] [ -D depth ] [ -N items ]\n");
+    fprintf(stderr, "       [ -s tap|rap ] [ -m jobs [ -x ] ] [ -k cachedir [ -K bytes ] [ -L ] ] infilename outfilename\n");
+    fprintf(stderr, "   outfilename: a file, - for the standard output, a FIFO, or unix:path for a Unix socket\n");
+    fprintf(stderr, "   -a : converts all file\n");
+    fprintf(stderr, "   -e : writes a TLV event for each item into evfilename\n");
+    fprintf(stderr, "   -f : format of the events: JSON Lines (default) or binary records\n");
+    fprintf(stderr, "   -l : reports only the items until this depth (0: top level)\n");
+    fprintf(stderr, "   -v : reports also the values of the primitive items\n");
+    fprintf(stderr, "   -c : saves checkpoints into ckptfilename and resumes from it if it exists\n");
+    fprintf(stderr, "   -i : input bytes between checkpoints (default %ld)\n", CKPT_INTERVAL);
+    fprintf(stderr, "   -p : I/O policy: stdio (default), stdio releasing the page cache, or O_DIRECT\n");
+    fprintf(stderr, "   -b : size of the buffer of the input and output files\n");
+    fprintf(stderr, "   -D : levels of nesting accepted (default %d)\n", MAX_DEPTH);
+    fprintf(stderr, "   -N : items accepted (default no limit)\n");
+    fprintf(stderr, "   -s : checks the structure against TAP 3.x or RAP and reports its records\n");
+    fprintf(stderr, "   -m : converts each top level item on its own, this many at once\n");
+    fprintf(stderr, "   -x : writes each top level item into outfilename.N (N from 1)\n");
+    fprintf(stderr, "   -k : takes the output from cachedir if the input was converted before\n");
+    fprintf(stderr, "   -K : bytes kept in cachedir, the least recently used go first (default %ld)\n", CACHE_MAX);
+    fprintf(stderr, "   -L : outfilename as a hard link into cachedir: it must not be modified\n");
+    exit(1);
+}
+
 /****************************************************************************
 |* 
 |* Function: write_tap
@@ -224,15 +875,56 @@ int write_tap(
 {
     asn1item            a_item;
     int                 indef_flag;
+    int                 ev_flag;
     indef_len_item*     len_list_free;
     long                size_indef;
+    long                item_pos;
+
+    /* 0. Resuming from a checkpoint: reopen the constructed items which were open */
+
+    if (ckpt.resume_depth >= 0)
+    {
+        if (depth < ckpt.resume_depth)
+        {
+            depth++;
+
+            if ( (write_tap(file,outfile,0,len_list) )==-1 )
+                return -1;
+
+            depth--;
+
+            if ( records_depth == depth )
+                records_depth=-1;
+
+            size=ckpt.frames[depth];
+        }
+        else
+        {
+            size=ckpt.resume_size;
+            ckpt.resume_depth=-1;
+        }
+    }
+
 
     /* 1. Process all size received from our parent */
 
     while (size >0)
     {
 
-        indef_flag=0;
+        item_pos=pos;
+
+        if (!depth)
+            PROBE2(write__item, pos, out_pos);
+
+        if ( ckpt.filename && pos - ckpt.last_pos >= ckpt.interval )
+            if ( ckpt_write(outfile, size) == -1 )
+                return -1;
+
+        if (io.mode == IO_NOCACHE)
+        {
+            io_advise(file, pos);
+            io_advise(outfile, out_pos - (long)io.out_len);
+        }
 
 
         /* 1.1. TAG:   decode */
@@ -245,6 +937,12 @@ int write_tap(
 
         size-=a_item.tag_l;
 
+        if ( !depth && !a_item.tag_x[0] && pos == in_size )
+        {
+            /* 1.1.1. Last byte of the padding */
+            break;
+        }
+
 
         /* 1.2. SIZE:  decode */
 
@@ -260,10 +958,13 @@ int write_tap(
 
         /* 1.3. Did we find 2 null bytes? */
 
-        if ( !a_item.tag && !a_item.size )
+        if ( !a_item.tag_x[0] && !a_item.size_x[0] )
         {
 
-            /* 1.3.1. End of indefinite length found */
+            /* 1.3.1. End of indefinite length found. At the top level it is padding between the items */
+
+            if (!depth)
+                continue;
 
             break;
 
@@ -273,11 +974,22 @@ int write_tap(
         /* 1.4. VALUE: collect indef sizes inside our value */
 
         { 
-            int i;
+            long i, j, n;
+            const schema_tag* s_tag=NULL;
+
+            if (schema)
+            {
+                s_tag=schema_lookup(&a_item);
+
+                if ( records_depth >= 0 && depth == records_depth+1 )
+                    record_no++;
+            }
+
+            /* 1.4.1. Arrange if indefinite Length, or definite whose content gets shorter */
 
-            /* 1.4.1. Arrange if indefinite Length */
+            indef_flag=( !a_item.size && a_item.size_x[0] );
 
-            if ( !a_item.size && a_item.size_x[0] )
+            if ( indef_flag || ( a_item.pc && (*len_list)->next && pos == (*len_list)->pos ) )
             {
                 if ( pos != (*len_list)->pos )
                 {
@@ -288,11 +1000,13 @@ int write_tap(
                 a_item.size=(*len_list)->len_def;
                 size_indef=(*len_list)->len;
 
+                if (indef_flag)
+                    PROBE3(indef__len, pos, out_pos, a_item.size);
+
                 len_list_free=*len_list;
                 *len_list=(*len_list)->next;
                 free(len_list_free);
-
-                indef_flag=1;
+                ckpt.consumed++;
 
             }
 
@@ -306,19 +1020,39 @@ int write_tap(
                 {
                     /* 1.4.2.1.1 Write */
 
-                    fwrite(a_item.tag_x, a_item.tag_l, 1, outfile);
-                    fwrite(a_item.size_x, a_item.size_l, 1, outfile);
+                    ev_flag=event_begin(&a_item, s_tag, item_pos, size_indef, indef_flag);
 
-                    for(i=0;i<a_item.size;i++)
+                    write_out(outfile, a_item.tag_x, a_item.tag_l);
+                    write_out(outfile, a_item.size_x, a_item.size_l);
+
+                    i=0;
+
+                    if ( !(ev_flag && events.values) && !ckpt.filename )
+                    {
+                        /* Straight from the input into a pipe or socket, where possible */
+
+                        if ( ( i=io_splice(file, outfile, pos, a_item.size) ) == -1 )
+                            return -1;
+                        out_pos+=i;
+                    }
+
+                    for(;i<a_item.size;i+=n)
                     {
-                        fputc(fgetc(file), outfile);
-                        if(feof(file))
+                        n=a_item.size-i < IO_COPY_BUF ? a_item.size-i : IO_COPY_BUF;
+                        if(fread(copy_buf, n, 1, file) != 1)
                         {
                             fprintf(stderr, "Found end of file too soon at position: %ld\n", pos);
                             return -1;
                         }
+                        write_out(outfile, copy_buf, n);
+                        if (ev_flag && events.values)
+                            for(j=0;j<n;j++)
+                                event_value(copy_buf[j]);
                     }
 
+                    if (ev_flag)
+                        event_end();
+
                 }
 
                 pos+=a_item.size;
@@ -334,15 +1068,31 @@ int write_tap(
                     if( (encode_size(a_item.size_x, a_item.size, &(a_item.size_l)))==-1)
                         return -1;
 
-                    fwrite(a_item.tag_x, a_item.tag_l, 1, outfile);
-                    fwrite(a_item.size_x, a_item.size_l, 1, outfile);
+                    if (event_begin(&a_item, s_tag, item_pos, size_indef, indef_flag))
+                        event_end();
+
+                    write_out(outfile, a_item.tag_x, a_item.tag_l);
+                    write_out(outfile, a_item.size_x, a_item.size_l);
 
                 }
                 
                 
+                if ( ckpt.filename && ckpt_push(size-size_indef) == -1 )
+                    return -1;
+
+                if ( s_tag && s_tag->kind == SCHEMA_RECORDS )
+                    records_depth=depth;
+
+                depth++;
+
                 if ( (write_tap(file,outfile,size_indef,len_list ) )==-1 )
                     return -1;
 
+                depth--;
+
+                if ( records_depth == depth )
+                    records_depth=-1;
+
             }
 
             size-=size_indef;
@@ -361,7 +1111,9 @@ int write_tap(
 |* 
 |* Description; 
 |* 
-|*     recursive function to find and stack all indef length in the file
+|*     recursive function to find and stack all indef length in the file.
+|*     Every item is decoded once and appended at the end of the list, so
+|*     the time and the memory used grow linearly with the file.
 |* 
 |* Return:
 |*      int > -1: Size of scanned item
@@ -377,15 +1129,16 @@ int write_tap(
 int collect_indef(
     FILE*               file,           /* File handler */
     long                size,           /* Size of parent. If 0, parent has indefinite length */
-    indef_len_item*     len_list,       /* List of indefinite length */
+    indef_len_item**    len_tail,       /* Last (empty) item of the list of indefinite length. NULL: just measure */
     long*               len,            /* To store indefinite Length */
     long*               len_def         /* To store definite Length */
 )
 {
-    int         parent_indef=FALSE,head=FALSE,i;
-    long        tot_size=0, tot_size_def=0, len_tmp=0, len_def_tmp=0;
+    int         parent_indef=FALSE,head=FALSE,size_l;
+    long        tot_size=0, tot_size_def=0, len_tmp, len_def_tmp, item_size, value_pos;
     asn1item    a_item;
-    uchar       buffin, buffin_str[4];
+    uchar       size_str[8];
+    indef_len_item* item, *item_inside;
 
 
     /* 1. We need to identify if this is the head, or if our parent has indefinite length for our loop */
@@ -395,12 +1148,31 @@ int collect_indef(
     else
         parent_indef=!size ? TRUE : FALSE;
 
-
+    if (depth > max_depth)
+    {
+        fprintf(stderr, "Found more than %d levels of nesting at position: %ld\n", max_depth, pos);
+        return -1;
+    }
+
+
     /* 2. Process all size received from our parent OR 'til a \0\0 is found */
 
 
     while ( parent_indef || size > 0 || head )
     {
+        if (!depth)
+            PROBE1(collect__item, pos);
+
+        if (io.mode == IO_NOCACHE)
+            io_advise(file, pos);
+
+        if ( max_items && ++items > max_items )
+        {
+            fprintf(stderr, "Found more than %ld items at position: %ld\n", max_items, pos);
+            return -1;
+        }
+
+
         /* 2.1. TAG:   decode */
 
         if (decode_tag(file, &a_item)==-1)
@@ -409,9 +1181,13 @@ int collect_indef(
             return -1;
         }
 
-        tot_size+=a_item.tag_l;
-        tot_size_def+=a_item.tag_l;
-        size-=a_item.tag_l;
+        if ( !depth && !a_item.tag_x[0] && pos == in_size )
+        {
+            /* 2.1.1. Last byte of the padding */
+
+            tot_size+=a_item.tag_l;
+            break;
+        }
 
 
         /* 2.2. SIZE:  decode */
@@ -422,121 +1198,185 @@ int collect_indef(
             return -1;
         }
 
-        tot_size+=a_item.size_l;
-        tot_size_def+=a_item.size_l;
-        size-=a_item.size_l;
+        item_size=a_item.tag_l+a_item.size_l;
 
 
         /* 2.3. Did we find 2 null bytes? */
 
-        if ( !a_item.tag && !a_item.size )
+        if ( !a_item.tag_x[0] && !a_item.size_x[0] )
         {
 
             /* 2.3.1. End of indefinite length found */
 
-            tot_size_def-=2;
-            break;
-            
+            if ( !parent_indef && depth )
+            {
+                fprintf(stderr, "End of indefinite length inside definite length at position: %ld\n", pos);
+                return -1;
+            }
+
+            tot_size+=item_size;
+
+            if ( depth || head )
+                break;
+
+            /* 2.3.2. At the top level it is just padding between the items: skip it */
+
+            size-=item_size;
+            continue;
+        }
+
+        if ( !depth && !a_item.tag_x[0] )
+        {
+            fprintf(stderr, "Found data after the padding at position: %ld\n", pos-item_size);
+            return -1;
         }
 
 
-        /* 2.4. VALUE: collect indef sizes inside our value */
+        /* 2.4. SCHEMA: is this the item we expect? */
+
+        if ( schema && schema_check(&a_item, schema_lookup(&a_item)) == -1 )
+            return -1;
+
+
+        /* 2.5. VALUE: collect indef sizes inside our value */
 
         if ( a_item.size || !a_item.size_x[0] )
         {
-            /* 2.4.1. Definite Length */
+            /* 2.5.1. Definite Length */
+
+            if ( a_item.size > in_size - pos )
+            {
+                fprintf(stderr, "Found end of file too soon at position: %ld\n", pos);
+                return -1;
+            }
 
             if (a_item.pc)
             {
-                /* 2.4.1.1. Constucted */
+                /* 2.5.1.1. Constucted: write_tap writes its length again, in as few bytes as possible */
 
-                while(!(!len_list->len && len_list->next==NULL))
+                len_tmp=len_def_tmp=0;
+                value_pos=pos;
+                item=len_tail ? *len_tail : NULL;
+
+                if (a_item.size)
                 {
-                    len_list=len_list->next;
+                    depth++;
+
+                    if( (collect_indef(file,a_item.size, len_tail, &len_tmp, &len_def_tmp) ) == -1 )
+                        return -1;
+
+                    depth--;
                 }
 
-                if (a_item.size)
-                    if( (collect_indef(file,a_item.size, len_list, &len_tmp, &len_def_tmp) ) == -1 )
+                if ( len_tmp != a_item.size )
+                {
+                    fprintf(stderr, "Content does not match the definite length at position: %ld\n", value_pos);
+                    return -1;
+                }
+
+                if ( len_def_tmp != len_tmp && item )
+                {
+                    /* 2.5.1.1.1. Its content gets shorter: the new length goes into the list too,
+                       ahead of the items found inside, which start at the old empty item */
+
+                    if ( ( item_inside=(indef_len_item*)malloc(sizeof(indef_len_item)) ) == NULL )
+                    {
+                        fprintf(stderr, "Problems allocating memory\n");
                         return -1;
+                    }
+                    *item_inside=*item;
 
-                tot_size+=len_tmp;
-                tot_size_def+=len_def_tmp;
-                
+                    if (*len_tail == item)
+                        *len_tail=item_inside;
+
+                    item->pos=value_pos;
+                    item->len=len_tmp;
+                    item->len_def=len_def_tmp;
+                    item->next=item_inside;
+                }
+
+                if( encode_size( size_str, len_def_tmp, &size_l) == -1 )
+                    return -1;
+
+                tot_size_def+=a_item.tag_l+size_l+len_def_tmp;
             }
             else
             {
-                /* 2.4.1.2. Primitive */
+                /* 2.5.1.2. Primitive: written as it is */
 
-                for (i=0;i<a_item.size;i++)
+                if ( fseek(file, a_item.size, SEEK_CUR) != 0 )
                 {
-                    buffin=fgetc(file);
-                    if(feof(file))
-                    {
-                        fprintf(stderr, "Found end of file too soon at position: %ld\n", pos);
-                        return -1;
-                    }
+                    fprintf(stderr, "Error moving to the position %ld of the file: %s\n", pos+a_item.size, strerror(errno));
+                    return -1;
                 }
                 pos+=a_item.size;
-                tot_size+=a_item.size;
-                tot_size_def+=a_item.size;
+
+                tot_size_def+=item_size+a_item.size;
             }
 
+            item_size+=a_item.size;
+            tot_size+=item_size;
 
         }
         else
         {
-            /* 2.4.2. Indefinite Length */
+            /* 2.5.2. Indefinite Length */
 
             if (!a_item.pc)
             {
-                /* 2.4.2.1. Primitive !!?? */
+                /* 2.5.2.1. Primitive !!?? */
                 fprintf(stderr, "Primitive Tag item with Indefinite Length at pos: %ld\n", pos );
                 return -1;
             }
 
-            while(!(!len_list->len && len_list->next==NULL))
-            {
-                len_list=len_list->next;
-            }
+            /* 2.5.2.2. Take the empty item at the end of the list, and add a new empty one */
+
+            item=len_tail ? *len_tail : NULL;
 
-            if ( ( len_list->next=(indef_len_item*)malloc(sizeof(indef_len_item)) ) == NULL )
+            if (item)
             {
-                fprintf(stderr, "Problems allocating memory\n");
-                return -1;
+                if ( ( item->next=(indef_len_item*)malloc(sizeof(indef_len_item)) ) == NULL )
+                {
+                    fprintf(stderr, "Problems allocating memory\n");
+                    return -1;
+                }
+                memset(item->next, 0x00, sizeof(indef_len_item));
+
+                *len_tail=item->next;
+
+                item->pos=pos;
             }
-            memset(len_list->next, 0x00, sizeof(indef_len_item));
 
-            len_list->pos=pos;
+            depth++;
 
-            if ( (collect_indef(file,a_item.size, len_list->next, &len_tmp, &len_def_tmp) )==-1 )
+            if ( (collect_indef(file,a_item.size, len_tail, &len_tmp, &len_def_tmp) )==-1 )
                 return -1;
 
-            tot_size+=len_list->len=len_tmp;
-            len_list->len_def=len_def_tmp;
+            depth--;
+
+            if (item)
+            {
+                item->len=len_tmp;
+                item->len_def=len_def_tmp;
+            }
 
-            if( ( len_def_tmp+=encode_size( buffin_str, len_def_tmp, (int *)&len_tmp)-1 ) == -1 )
+            if( encode_size( size_str, len_def_tmp, &size_l) == -1 )
                 return -1;
 
-            tot_size_def+=len_def_tmp;
+            tot_size_def+=a_item.tag_l+size_l+len_def_tmp;
+            item_size+=len_tmp;
+            tot_size+=item_size;
     
         }
 
 
-        /* 2.5. The HEAD Tag will be executed just once */
+        /* 2.6. The HEAD Tag will be executed just once */
 
         if (head)
-        {
-            if (!a_item.size)
-            {
-                pos+=2;
-                tot_size+=2;
-                tot_size_def+=2;
-            }
             break;
-                
-        }
 
-        size-=tot_size;
+        if (!parent_indef)
+            size-=item_size;
 
     }
 
@@ -605,7 +1445,7 @@ int decode_tag(
     {
         /* 3.1 Tag has more than one octet */
 
-        for(i=1;i<=4;i++) 
+        for(i=1;i<(int)sizeof(a_item->tag_x);i++) 
         {
             buffin=fgetc(file);
             if(feof(file))
@@ -625,7 +1465,7 @@ int decode_tag(
 
         }
 
-        if ( i>3 )
+        if ( i>=(int)sizeof(a_item->tag_x) )
         {
             fprintf(stderr, "Found tag bigger than 4 bytes at position: %ld\n", pos);
             return -1;
@@ -639,8 +1479,6 @@ int decode_tag(
         a_item->tag=(int)buffin&0x1F;
     }
 
-    bcd_2_hexa(a_item->tag_h, a_item->tag_x, a_item->tag_l);
-
     return 0;
 
 }
@@ -698,9 +1536,15 @@ int decode_size(
 
     if (buffin>>7)
     {
-        /* 3.1. Size with more than one octet */
+        /* 3.1. Size with more than one octet. It must fit into a long */
+
+        if ( (int)(a_item->size_x[0]&0x7F) >= (int)sizeof(long) )
+        {
+            fprintf(stderr, "Found size bigger than %d bytes at position: %ld\n", (int)sizeof(long), pos);
+            return -1;
+        }
 
-        for(i=1;(i<=(int)(a_item->size_x[0]&0x7F)) && (i<=4);i++)
+        for(i=1;i<=(int)(a_item->size_x[0]&0x7F);i++)
         {
             buffin=fgetc(file);
             if(feof(file))
@@ -716,12 +1560,6 @@ int decode_size(
             a_item->size_l+=1;
         }
 
-        if ( i>7 )
-        {
-            fprintf(stderr, "Found size bigger than 8 bytes at position: %ld\n", pos);
-            return -1;
-        }
-
     }
     else
     {
@@ -730,8 +1568,6 @@ int decode_size(
         a_item->size=(int)(buffin);
     }
 
-    bcd_2_hexa(a_item->size_h, a_item->size_x, a_item->size_l);
-
     return 0;
 
 }
@@ -789,12 +1625,13 @@ void bcd_2_hexa(
 ****************************************************************************/
 int encode_size(
     uchar*      size2,      /* Where to store the encoded size */
-    int         size1,      /* size in integer format */
+    long        size1,      /* size in integer format */
     int*        len         /* Where to store the length of the new size */
 )
 {
 
-    int i, size1_cpy=size1, size1_oct=0;
+    int i, size1_oct=0;
+    long size1_cpy=size1;
 
     if (size1>>7)
     {
@@ -866,3 +1703,2408 @@ void dump_indef(
         len_list = len_list->next;
     }
 }
+
+
+/****************************************************************************
+|* 
+|* Function: event_begin
+|* 
+|* Description; 
+|* 
+|*     Writes the TLV event of an item, as found while converting, into the
+|*     event file. Items deeper than the requested depth are not reported.
+|*
+|*     JSON Lines: one object per item, e.g.
+|*       {"pos":0,"in_len":14,"out_pos":0,"depth":0,"class":1,"pc":1,
+|*        "tag":1,"tag_h":"61","indef":1,"len":12,"hdr":2}
+|*     with a "value" member in hexadecimal when values are requested and,
+|*     when checking against a schema, "name" for the items it knows and
+|*     "record" (counting from 1) for its records.
+|*
+|*     Binary: one record per item, integers in network byte order
+|*        0  1  flags: class<<6 | pc<<5 | indef<<4 | value follows<<3
+|*        1  1  depth (255 if deeper)
+|*        2  4  tag
+|*        6  8  position of the item in the input file
+|*       14  8  length of the value in the input file (inclusive \0\0)
+|*       22  8  position of the item in the output file
+|*       30  8  definite length of the value
+|*       38  1  length of tag and size in the output file
+|*     followed by the value for primitive items when values are requested.
+|*
+|*     event_value() and event_end() must follow for each reported item.
+|* 
+|* Return:
+|*      TRUE:  Event started
+|*      FALSE: Item not reported
+|* 
+|* Modifications:
+|* 20261018    Initial version
+|* 
+****************************************************************************/
+int event_begin(
+    const asn1item*     a_item,         /* Item as it will be written */
+    const schema_tag*   s_tag,          /* Its entry in the schema. NULL: not known or no schema */
+    long                in_pos,         /* Position of the item in the input file */
+    long                in_len,         /* Length of the value in the input file */
+    int                 indef           /* Item had indefinite length */
+)
+{
+    uchar               rec[39];
+    char                tag_h[9];
+    unsigned long long  num[5];
+    int                 i, j, with_value;
+
+
+    /* 1. Should we report it? */
+
+    if (!events.file || ( events.depth >= 0 && depth > events.depth ) )
+        return FALSE;
+
+    with_value=events.values && !a_item->pc;
+    events.in_value=with_value;
+
+
+    /* 2. Write according to the format */
+
+    if (events.format == EVENT_JSON)
+    {
+        bcd_2_hexa(tag_h, a_item->tag_x, a_item->tag_l);
+
+        fprintf(events.file,
+                "{\"pos\":%ld,\"in_len\":%ld,\"out_pos\":%ld,\"depth\":%d,\"class\":%d,\"pc\":%d,"
+                "\"tag\":%d,\"tag_h\":\"%s\",\"indef\":%d,\"len\":%ld,\"hdr\":%d",
+                in_pos, in_len, out_pos, depth, a_item->class, a_item->pc,
+                a_item->tag, tag_h, indef ? 1 : 0, a_item->size,
+                a_item->tag_l + a_item->size_l);
+
+        if (s_tag)
+            fprintf(events.file, ",\"name\":\"%s\"", s_tag->name);
+
+        if ( records_depth >= 0 && depth == records_depth+1 )
+            fprintf(events.file, ",\"record\":%ld", record_no);
+
+        if (with_value)
+            fputs(",\"value\":\"", events.file);
+    }
+    else
+    {
+        rec[0]=(uchar)( (a_item->class<<6) | (a_item->pc<<5) | ((indef?1:0)<<4) | (with_value<<3) );
+        rec[1]=(uchar)( depth > 255 ? 255 : depth );
+
+        num[0]=(unsigned long long)a_item->tag;
+        num[1]=(unsigned long long)in_pos;
+        num[2]=(unsigned long long)in_len;
+        num[3]=(unsigned long long)out_pos;
+        num[4]=(unsigned long long)a_item->size;
+
+        for (i=0;i<4;i++)
+            rec[2+i]=(uchar)( num[0] >> (8*(3-i)) );
+
+        for (j=1;j<5;j++)
+            for (i=0;i<8;i++)
+                rec[6+(j-1)*8+i]=(uchar)( num[j] >> (8*(7-i)) );
+
+        rec[38]=(uchar)( a_item->tag_l + a_item->size_l );
+
+        fwrite(rec, sizeof(rec), 1, events.file);
+    }
+
+    return TRUE;
+}
+
+
+/****************************************************************************
+|* 
+|* Function: event_value
+|* 
+|* Description; 
+|* 
+|*     Writes one octet of the value of the current primitive item
+|* 
+|* Return:
+|*      void
+|* 
+|* Modifications:
+|* 20261018    Initial version
+|* 
+****************************************************************************/
+void event_value(
+    uchar               value           /* Octet of the value */
+)
+{
+    if (events.format == EVENT_JSON)
+        fprintf(events.file, "%02x", value);
+    else
+        fputc(value, events.file);
+}
+
+
+/****************************************************************************
+|* 
+|* Function: event_end
+|* 
+|* Description; 
+|* 
+|*     Closes the event of the current item
+|* 
+|* Return:
+|*      void
+|* 
+|* Modifications:
+|* 20261018    Initial version
+|* 
+****************************************************************************/
+void event_end(void)
+{
+    if (events.format == EVENT_JSON)
+        fputs(events.in_value ? "\"}\n" : "}\n", events.file);
+
+    events.in_value=FALSE;
+}
+
+
+/****************************************************************************
+|* 
+|* Function: write_out
+|* 
+|* Description; 
+|* 
+|*     Writes into the output file keeping track of the position and, when
+|*     checkpoints are requested, of the hash of everything written. The
+|*     bytes are gathered in a buffer of their own, written out by
+|*     write_flush once full.
+|* 
+|* Return:
+|*      void
+|* 
+|* Modifications:
+|* 20261018    Initial version
+|* 
+****************************************************************************/
+void write_out(
+    FILE*               outfile,        /* File handler to write */
+    const uchar*        buf,            /* What to write */
+    long                len             /* Number of bytes */
+)
+{
+    long                i;
+
+
+    /* 1. No room left: write out what is there */
+
+    if ( io.out_len + len > io.out_size )
+    {
+        write_flush(outfile);
+
+        if ( !io.out_buf )
+        {
+            io.out_size=io.bufsize ? io.bufsize : IO_OUT_BUF;
+
+            if ( ( io.out_buf=(uchar*)malloc(io.out_size) ) == NULL )
+                io.out_size=0;
+        }
+    }
+
+
+    /* 2. Into the buffer, or straight to the file if it does not fit */
+
+    if ( len <= (long)io.out_size )
+    {
+        memcpy(io.out_buf + io.out_len, buf, len);
+        io.out_len+=len;
+        out_pos+=len;
+    }
+    else
+    {
+        fwrite(buf, len, 1, outfile);
+        fflush(outfile);
+        out_pos+=len;
+
+        PROBE2(flush, io_find(outfile) ? io_find(outfile)->fd : fileno(outfile), out_pos);
+    }
+
+    if (ckpt.filename)
+    {
+        for (i=0;i<len;i++)
+        {
+            ckpt.out_hash^=buf[i];
+            ckpt.out_hash*=FNV_PRIME;
+        }
+    }
+}
+
+
+/****************************************************************************
+|* 
+|* Function: write_flush
+|* 
+|* Description; 
+|* 
+|*     Writes out the buffer of write_out and flushes the output file
+|* 
+|* Return:
+|*      0: Successful
+|*     -1: Error writing, now or before
+|* 
+|* Modifications:
+|* 20261018    Initial version
+|* 
+****************************************************************************/
+int write_flush(
+    FILE*               outfile         /* File handler to write */
+)
+{
+    size_t              len=io.out_len;
+
+    io.out_len=0;
+
+    if ( len && fwrite(io.out_buf, len, 1, outfile) != 1 )
+        return -1;
+
+    if ( fflush(outfile) != 0 || ferror(outfile) )
+        return -1;
+
+    if (len)
+        PROBE2(flush, io_find(outfile) ? io_find(outfile)->fd : fileno(outfile), out_pos);
+
+    return 0;
+}
+
+
+/****************************************************************************
+|* 
+|* Function: ckpt_push
+|* 
+|* Description; 
+|* 
+|*     Stores, before write_tap goes one level down, the size which will be
+|*     left at the current level once the constructed item is written
+|* 
+|* Return:
+|*      0: Successful
+|*     -1: Error allocating memory
+|* 
+|* Modifications:
+|* 20261018    Initial version
+|* 
+****************************************************************************/
+int ckpt_push(
+    long                size_after      /* Size left after the constructed item */
+)
+{
+    long*               frames;
+    int                 frames_max;
+
+    if (depth >= ckpt.frames_max)
+    {
+        frames_max=ckpt.frames_max ? ckpt.frames_max*2 : 32;
+
+        if ( ( frames=(long*)realloc(ckpt.frames, frames_max*sizeof(long)) ) == NULL )
+        {
+            fprintf(stderr, "Problems allocating memory\n");
+            return -1;
+        }
+
+        ckpt.frames=frames;
+        ckpt.frames_max=frames_max;
+    }
+
+    ckpt.frames[depth]=size_after;
+
+    return 0;
+}
+
+
+/****************************************************************************
+|* 
+|* Function: ckpt_write
+|* 
+|* Description; 
+|* 
+|*     Saves the state of the conversion so that a rerun can continue from
+|*     here. The output written so far is flushed to disk first and the
+|*     checkpoint file is replaced atomically.
+|* 
+|* Return:
+|*      0: Successful
+|*     -1: Error writing
+|* 
+|* Modifications:
+|* 20261018    Initial version
+|* 
+****************************************************************************/
+int ckpt_write(
+    FILE*               outfile,        /* File handler of the output */
+    long                size            /* Size left at the current level */
+)
+{
+    FILE*               f;
+    char*               tmp_filename;
+    int                 i, ret=-1;
+
+
+    /* 1. Everything written until now must be on disk */
+
+    if ( write_flush(outfile) != 0 || io_sync(outfile) != 0 )
+    {
+        fprintf(stderr, "Error writing the output file: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (events.file)
+    {
+        if ( fflush(events.file) != 0 || fsync(fileno(events.file)) != 0 )
+        {
+            fprintf(stderr, "Error writing the event file: %s\n", strerror(errno));
+            return -1;
+        }
+        ckpt.ev_pos=ftell(events.file);
+    }
+
+
+    /* 2. Write the checkpoint into a temporary file */
+
+    if ( ( tmp_filename=(char*)malloc(strlen(ckpt.filename)+5) ) == NULL )
+    {
+        fprintf(stderr, "Problems allocating memory\n");
+        return -1;
+    }
+    sprintf(tmp_filename, "%s.tmp", ckpt.filename);
+
+    if ( ( f=fopen(tmp_filename, "w") ) == NULL )
+    {
+        fprintf(stderr, "Cannot open file %s\n", tmp_filename);
+        free(tmp_filename);
+        return -1;
+    }
+
+    fprintf(f, "%s\n", CKPT_MAGIC);
+    fprintf(f, "in_size %ld\n", in_size);
+    fprintf(f, "in_id %s\n", ckpt.in_id);
+    fprintf(f, "all_file %d\n", all_file);
+    fprintf(f, "pos %ld\n", pos);
+    fprintf(f, "out_pos %ld\n", out_pos);
+    fprintf(f, "out_hash %llx\n", ckpt.out_hash);
+    fprintf(f, "ev_pos %ld\n", ckpt.ev_pos);
+    fprintf(f, "consumed %ld\n", ckpt.consumed);
+    fprintf(f, "records %d %ld\n", records_depth, record_no);
+    fprintf(f, "size %ld\n", size);
+    fprintf(f, "depth %d\n", depth);
+
+    for (i=0;i<depth;i++)
+        fprintf(f, "frame %ld\n", ckpt.frames[i]);
+
+
+    /* 3. And replace the previous one */
+
+    if ( fflush(f) != 0 || fsync(fileno(f)) != 0 )
+    {
+        fprintf(stderr, "Error writing file %s: %s\n", tmp_filename, strerror(errno));
+        fclose(f);
+    }
+    else if ( fclose(f) != 0 || rename(tmp_filename, ckpt.filename) != 0 )
+    {
+        fprintf(stderr, "Error writing file %s: %s\n", ckpt.filename, strerror(errno));
+    }
+    else
+    {
+        ckpt.last_pos=pos;
+        ret=0;
+    }
+
+    free(tmp_filename);
+
+    return ret;
+}
+
+
+/****************************************************************************
+|* 
+|* Function: ckpt_read
+|* 
+|* Description; 
+|* 
+|*     Loads the checkpoint left by a previous run, if any, and prepares
+|*     write_tap to reopen the constructed items which were open
+|* 
+|* Return:
+|*      TRUE:  Checkpoint loaded
+|*      FALSE: No checkpoint
+|*     -1: Error reading or checkpoint of another input
+|* 
+|* Modifications:
+|* 20261018    Initial version
+|* 
+****************************************************************************/
+int ckpt_read(void)
+{
+    FILE*               f;
+    char                magic[64], ckpt_in_id[96];
+    long                ckpt_in_size, ckpt_pos, ckpt_out_pos, size;
+    int                 ckpt_all_file, ckpt_depth;
+
+
+    /* 1. Is there any checkpoint? */
+
+    if ( ( f=fopen(ckpt.filename, "r") ) == NULL )
+    {
+        if (errno == ENOENT)
+            return FALSE;
+
+        fprintf(stderr, "Cannot open file %s\n", ckpt.filename);
+        return -1;
+    }
+
+
+    /* 2. Read it */
+
+    if ( fgets(magic, sizeof(magic), f) == NULL || strcmp(magic, CKPT_MAGIC "\n") != 0
+      || fscanf(f, "in_size %ld\n", &ckpt_in_size) != 1
+      || fscanf(f, "in_id %95s\n", ckpt_in_id) != 1
+      || fscanf(f, "all_file %d\n", &ckpt_all_file) != 1
+      || fscanf(f, "pos %ld\n", &ckpt_pos) != 1
+      || fscanf(f, "out_pos %ld\n", &ckpt_out_pos) != 1
+      || fscanf(f, "out_hash %llx\n", &ckpt.out_hash) != 1
+      || fscanf(f, "ev_pos %ld\n", &ckpt.ev_pos) != 1
+      || fscanf(f, "consumed %ld\n", &ckpt.consumed) != 1
+      || fscanf(f, "records %d %ld\n", &records_depth, &record_no) != 2
+      || fscanf(f, "size %ld\n", &size) != 1
+      || fscanf(f, "depth %d\n", &ckpt_depth) != 1
+      || ckpt_depth < 0 )
+    {
+        fprintf(stderr, "Invalid checkpoint file %s\n", ckpt.filename);
+        fclose(f);
+        return -1;
+    }
+
+    if ( ckpt_in_size != in_size || strcmp(ckpt_in_id, ckpt.in_id) != 0 || ckpt_all_file != all_file )
+    {
+        fprintf(stderr, "Checkpoint file %s does not belong to this conversion\n", ckpt.filename);
+        fclose(f);
+        return -1;
+    }
+
+    for (depth=0;depth<ckpt_depth;depth++)
+    {
+        if ( ckpt_push(0) == -1 )
+        {
+            fclose(f);
+            return -1;
+        }
+
+        if ( fscanf(f, "frame %ld\n", &ckpt.frames[depth]) != 1 )
+        {
+            fprintf(stderr, "Invalid checkpoint file %s\n", ckpt.filename);
+            fclose(f);
+            return -1;
+        }
+    }
+
+    fclose(f);
+
+
+    /* 3. Continue from there */
+
+    depth=0;
+    pos=ckpt.last_pos=ckpt_pos;
+    out_pos=ckpt_out_pos;
+    ckpt.resume_depth=ckpt_depth;
+    ckpt.resume_size=size;
+
+    return TRUE;
+}
+
+
+/****************************************************************************
+|* 
+|* Function: ckpt_reopen
+|* 
+|* Description; 
+|* 
+|*     Checks that the part of a file written by a previous run covered
+|*     by the checkpoint is the one we wrote and drops the rest
+|* 
+|* Return:
+|*      0: Successful
+|*     -1: Error or file not matching the checkpoint
+|* 
+|* Modifications:
+|* 20261018    Initial version
+|* 
+****************************************************************************/
+int ckpt_reopen(
+    const char*         filename,       /* File to reopen */
+    long                len,            /* Bytes covered by the checkpoint */
+    int                 verify          /* Check them against the hash of the checkpoint */
+)
+{
+    FILE*               f;
+    uchar               buf[65536];
+    unsigned long long  hash=FNV_OFFSET;
+    long                left=len, i;
+    size_t              n;
+
+
+    /* 1. Open for update */
+
+    if ( ( f=fopen(filename, "r+b") ) == NULL )
+    {
+        fprintf(stderr, "Cannot open file %s\n", filename);
+        return -1;
+    }
+
+
+    /* 2. Check what we already wrote */
+
+    if (verify)
+    {
+        while (left > 0)
+        {
+            n=fread(buf, 1, left < (long)sizeof(buf) ? (size_t)left : sizeof(buf), f);
+            if (n == 0)
+                break;
+
+            for (i=0;i<(long)n;i++)
+            {
+                hash^=buf[i];
+                hash*=FNV_PRIME;
+            }
+            left-=n;
+        }
+
+        if (left || hash != ckpt.out_hash)
+        {
+            fprintf(stderr, "File %s does not match the checkpoint %s\n", filename, ckpt.filename);
+            fclose(f);
+            return -1;
+        }
+    }
+
+
+    /* 3. Drop anything written after the checkpoint */
+
+    if ( ftruncate(fileno(f), len) != 0 )
+    {
+        fprintf(stderr, "Error truncating file %s: %s\n", filename, strerror(errno));
+        fclose(f);
+        return -1;
+    }
+
+    fclose(f);
+
+    return 0;
+}
+
+
+/****************************************************************************
+|* 
+|* Function: table_save
+|* 
+|* Description; 
+|* 
+|*     Saves the list of indefinite length found by collect_indef, so that
+|*     a resumed conversion does not need to scan the input again
+|* 
+|* Return:
+|*      0: Successful
+|*     -1: Error writing
+|* 
+|* Modifications:
+|* 20261018    Initial version
+|* 
+****************************************************************************/
+int table_save(
+    indef_len_item*     len_list        /* List of indefinite length */
+)
+{
+    FILE*               f;
+    long                rec[3];
+
+    if ( ( f=fopen(ckpt.tbl_filename, "wb") ) == NULL )
+    {
+        fprintf(stderr, "Cannot open file %s\n", ckpt.tbl_filename);
+        return -1;
+    }
+
+    /* The last item of the list is always empty */
+
+    for (; len_list && len_list->next; len_list=len_list->next)
+    {
+        rec[0]=len_list->pos;
+        rec[1]=len_list->len;
+        rec[2]=len_list->len_def;
+        fwrite(rec, sizeof(rec), 1, f);
+    }
+
+    if ( fflush(f) != 0 || fsync(fileno(f)) != 0 || fclose(f) != 0 )
+    {
+        fprintf(stderr, "Error writing file %s: %s\n", ckpt.tbl_filename, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/****************************************************************************
+|* 
+|* Function: table_load
+|* 
+|* Description; 
+|* 
+|*     Rebuilds the list of indefinite length saved by table_save, without
+|*     the items already written
+|* 
+|* Return:
+|*      List of indefinite length
+|*      NULL: Error
+|* 
+|* Modifications:
+|* 20261018    Initial version
+|* 
+****************************************************************************/
+indef_len_item* table_load(
+    long                skip            /* Items already written */
+)
+{
+    FILE*               f;
+    long                rec[3];
+    indef_len_item*     head=NULL;
+    indef_len_item**    tail=&head;
+
+    if ( ( f=fopen(ckpt.tbl_filename, "rb") ) == NULL )
+    {
+        fprintf(stderr, "Cannot open file %s\n", ckpt.tbl_filename);
+        return NULL;
+    }
+
+    if ( fseek(f, skip*(long)sizeof(rec), SEEK_SET) != 0 )
+    {
+        fprintf(stderr, "Invalid file %s\n", ckpt.tbl_filename);
+        fclose(f);
+        return NULL;
+    }
+
+    do
+    {
+        if ( ( *tail=(indef_len_item*)malloc(sizeof(indef_len_item)) ) == NULL )
+        {
+            fprintf(stderr, "Problems allocating memory\n");
+            fclose(f);
+            return NULL;
+        }
+        memset(*tail, 0x00, sizeof(indef_len_item));
+
+        if ( fread(rec, sizeof(rec), 1, f) != 1 )
+            break;
+
+        (*tail)->pos=rec[0];
+        (*tail)->len=rec[1];
+        (*tail)->len_def=rec[2];
+        tail=&(*tail)->next;
+
+    } while (TRUE);
+
+    fclose(f);
+
+    return head;
+}
+
+
+/****************************************************************************
+|* 
+|* Function: io_open
+|* 
+|* Description; 
+|* 
+|*     Opens the input or output file according to the I/O policy:
+|*
+|*       IO_NORMAL:  stdio, with a buffer of io.bufsize if given
+|*       IO_NOCACHE: as IO_NORMAL, reading sequentially and releasing from
+|*                   the page cache what was already read or written, so
+|*                   that converting does not evict the data of others
+|*       IO_DIRECT:  O_DIRECT through aligned buffers of io.bufsize,
+|*                   bypassing the page cache
+|*
+|*     An output to the standard output, a pipe or a socket (see
+|*     io_is_stream) is always written through stdio.
+|* 
+|* Return:
+|*      File handler
+|*      NULL: Error
+|* 
+|* Modifications:
+|* 20261018    Initial version
+|* 
+****************************************************************************/
+FILE* io_open(
+    const char*         filename,       /* File to open */
+    const char*         mode            /* "rb", "wb" or "r+b" */
+)
+{
+    io_file*            f;
+    struct stat         st;
+    int                 fd;
+
+    if ( ( f=(io_file*)malloc(sizeof(io_file)) ) == NULL )
+    {
+        fprintf(stderr, "Problems allocating memory\n");
+        return NULL;
+    }
+    memset(f, 0x00, sizeof(io_file));
+    f->buf_off=-1;
+    f->writing=( mode[0] != 'r' || strchr(mode, '+') != NULL );
+    f->stream=( mode[0] == 'w' && io_is_stream(filename) );
+
+    if ( mode[0] == 'w' && !f->stream )
+        io_unshare(filename);
+
+    if (f->stream)
+    {
+        /* 0. Standard output, pipe or socket */
+
+        if ( ( fd=io_connect(filename) ) == -1 )
+        {
+            free(f);
+            return NULL;
+        }
+
+        if ( ( f->file=fdopen(fd, mode) ) == NULL )
+        {
+            close(fd);
+            free(f);
+            return NULL;
+        }
+
+        f->pipe=( fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode) );
+    }
+
+    if ( io.mode != IO_DIRECT || f->stream )
+    {
+        /* 1. stdio */
+
+        if ( !f->stream && ( f->file=fopen(filename, mode) ) == NULL )
+        {
+            free(f);
+            return NULL;
+        }
+        f->fd=fileno(f->file);
+
+        if (io.bufsize)
+        {
+            if ( ( f->vbuf=(char*)malloc(io.bufsize) ) == NULL || setvbuf(f->file, f->vbuf, _IOFBF, io.bufsize) != 0 )
+            {
+                fprintf(stderr, "Cannot set a buffer of %lu bytes\n", (unsigned long)io.bufsize);
+                fclose(f->file);
+                free(f->vbuf);
+                free(f);
+                return NULL;
+            }
+        }
+
+#ifdef POSIX_FADV_SEQUENTIAL
+        if (io.mode == IO_NOCACHE && mode[0] == 'r')
+            posix_fadvise(f->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    }
+#ifdef IO_HAVE_DIRECT
+    else
+    {
+        /* 2. O_DIRECT: the buffer must be aligned and a multiple of the alignment */
+
+        cookie_io_functions_t funcs={ io_direct_read, io_direct_write, io_direct_seek, io_direct_close };
+        int             flags;
+
+        if (!io.bufsize)
+            io.bufsize=IO_DIRECT_BUF;
+        io.bufsize=(io.bufsize+IO_ALIGN-1) & ~(size_t)(IO_ALIGN-1);
+
+        if (strcmp(mode, "rb") == 0)
+            flags=O_RDONLY;
+        else if (strcmp(mode, "wb") == 0)
+            flags=O_WRONLY|O_CREAT|O_TRUNC;
+        else
+            flags=O_RDWR;
+
+        if ( ( f->fd=open(filename, flags|O_DIRECT, 0666) ) == -1 )
+        {
+            free(f);
+            return NULL;
+        }
+
+        if ( fstat(f->fd, &st) != 0 || posix_memalign((void**)&f->buf, IO_ALIGN, io.bufsize) != 0 )
+        {
+            close(f->fd);
+            free(f);
+            return NULL;
+        }
+        f->end=st.st_size;
+
+        if ( ( f->file=fopencookie(f, mode, funcs) ) == NULL )
+        {
+            close(f->fd);
+            free(f->buf);
+            free(f);
+            return NULL;
+        }
+    }
+#endif
+
+    f->next=io.files;
+    io.files=f;
+
+    return f->file;
+}
+
+
+/****************************************************************************
+|* 
+|* Function: io_close
+|* 
+|* Description; 
+|* 
+|*     Closes a file opened with io_open(), releasing it from the page
+|*     cache under IO_NOCACHE
+|* 
+|* Return:
+|*      0: Successful
+|*     EOF: Error
+|* 
+|* Modifications:
+|* 20261018    Initial version
+|* 
+****************************************************************************/
+int io_close(
+    FILE*               file            /* File handler */
+)
+{
+    io_file*            f;
+    io_file**           prev;
+    int                 ret;
+
+    for (prev=&io.files; *prev && (*prev)->file != file; prev=&(*prev)->next)
+        ;
+
+    if ( ( f=*prev ) == NULL )
+        return fclose(file);
+
+    *prev=f->next;
+
+    if (io.mode == IO_NOCACHE && f->writing && !f->stream)
+        io_sync(file);
+
+#ifdef POSIX_FADV_DONTNEED
+    if (io.mode == IO_NOCACHE)
+        posix_fadvise(f->fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+
+    ret=fclose(file);
+
+    free(f->vbuf);
+    free(f->buf);
+    free(f);
+
+    return ret;
+}
+
+
+/****************************************************************************
+|* 
+|* Function: io_find
+|* 
+|* Description; 
+|* 
+|*     Finds the io_file behind a file handler
+|* 
+|* Return:
+|*      io_file
+|*      NULL: Not opened with io_open()
+|* 
+|* Modifications:
+|* 20261018    Initial version
+|* 
+****************************************************************************/
+io_file* io_find(
+    FILE*               file            /* File handler */
+)
+{
+    io_file*            f;
+
+    for (f=io.files; f && f->file != file; f=f->next)
+        ;
+
+    return f;
+}
+
+
+/****************************************************************************
+|* 
+|* Function: io_sync
+|* 
+|* Description; 
+|* 
+|*     Writes to disk everything written into the file until now
+|* 
+|* Return:
+|*      0: Successful
+|*     -1: Error
+|* 
+|* Modifications:
+|* 20261018    Initial version
+|* 
+****************************************************************************/
+int io_sync(
+    FILE*               file            /* File handler */
+)
+{
+    io_file*            f=io_find(file);
+
+    if ( fflush(file) != 0 )
+        return -1;
+
+    if (!f)
+        return fsync(fileno(file));
+
+    if ( f->buf && io_direct_flush(f) != 0 )
+        return -1;
+
+    return fsync(f->fd);
+}
+
+
+/****************************************************************************
+|* 
+|* Function: io_advise
+|* 
+|* Description; 
+|* 
+|*     IO_NOCACHE: once enough has been read or written, tells the kernel
+|*     that the pages behind us are not needed anymore. Pages written must
+|*     reach the disk before they can be dropped.
+|* 
+|* Return:
+|*      void
+|* 
+|* Modifications:
+|* 20261018    Initial version
+|* 
+****************************************************************************/
+void io_advise(
+    FILE*               file,           /* File handler */
+    long                len             /* Bytes already read or written */
+)
+{
+#ifdef POSIX_FADV_DONTNEED
+    io_file*            f=io_find(file);
+
+    if ( !f || f->stream )
+        return;
+
+    if ( f->advised > len )
+    {
+        /* The file was rewound: start again */
+        f->advised=0;
+    }
+
+    if ( len - f->advised < IO_ADVISE_CHUNK )
+        return;
+
+    if ( f->writing )
+    {
+        if ( fflush(file) != 0 || fdatasync(f->fd) != 0 )
+            return;
+
+        PROBE2(flush, f->fd, len);
+    }
+
+    len&=~(long)(IO_ALIGN-1);
+
+    posix_fadvise(f->fd, f->advised, len - f->advised, POSIX_FADV_DONTNEED);
+    f->advised=len;
+#endif
+}
+
+/****************************************************************************
+|* 
+|* Function: io_unshare
+|* 
+|* Description; 
+|* 
+|*     Removes a regular file about to be written from scratch when it has
+|*     other hard links, such as an output served from the cache with -L:
+|*     truncating it would change the entry of the cache too. The file is
+|*     then created anew.
+|* 
+|* Return:
+|*      void
+|* 
+|* Modifications:
+|* 20261018    Initial version
+|* 
+****************************************************************************/
+void io_unshare(
+    const char*         filename        /* File to write */
+)
+{
+    struct stat         st;
+
+    if ( lstat(filename, &st) == 0 && S_ISREG(st.st_mode) && st.st_nlink > 1 )
+        unlink(filename);
+}
+
+
+/****************************************************************************
+|* 
+|* Function: io_is_stream
+|* 
+|* Description; 
+|* 
+|*     Whether an output file name stands for a stream rather than a
+|*     regular file: "-" (standard output), "unix:path" (Unix socket), or
+|*     an existing FIFO or socket
+|* 
+|* Return:
+|*      TRUE/FALSE
+|* 
+|* Modifications:
+|* 20261018    Initial version
+|* 
+****************************************************************************/
+int io_is_stream(
+    const char*         filename        /* Output file */
+)
+{
+    struct stat         st;
+
+    if ( strcmp(filename, "-") == 0 || strncmp(filename, IO_UNIX_PREFIX, strlen(IO_UNIX_PREFIX)) == 0 )
+        return TRUE;
+
+    return ( stat(filename, &st) == 0 && ( S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode) ) );
+}
+
+
+/****************************************************************************
+|* 
+|* Function: io_connect
+|* 
+|* Description; 
+|* 
+|*     Opens a stream named as in io_is_stream for writing: the FIFO is
+|*     opened, the socket connected to
+|* 
+|* Return:
+|*      File descriptor
+|*     -1: Error
+|* 
+|* Modifications:
+|* 20261018    Initial version
+|* 
+****************************************************************************/
+int io_connect(
+    const char*         filename        /* Output file */
+)
+{
+    struct sockaddr_un  addr;
+    struct stat         st;
+    int                 fd;
+
+
+    /* 1. Standard output and FIFOs */
+
+    if ( strcmp(filename, "-") == 0 )
+        return dup(STDOUT_FILENO);
+
+    if ( strncmp(filename, IO_UNIX_PREFIX, strlen(IO_UNIX_PREFIX)) == 0 )
+        filename+=strlen(IO_UNIX_PREFIX);
+    else if ( stat(filename, &st) == 0 && S_ISFIFO(st.st_mode) )
+        return open(filename, O_WRONLY);
+
+
+    /* 2. Unix sockets */
+
+    if ( strlen(filename) >= sizeof(addr.sun_path) )
+    {
+        errno=ENAMETOOLONG;
+        return -1;
+    }
+
+    memset(&addr, 0x00, sizeof(addr));
+    addr.sun_family=AF_UNIX;
+    strcpy(addr.sun_path, filename);
+
+    if ( ( fd=socket(AF_UNIX, SOCK_STREAM, 0) ) == -1 )
+        return -1;
+
+    if ( connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 )
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+/****************************************************************************
+|* 
+|* Function: io_splice
+|* 
+|* Description; 
+|* 
+|*     Moves a primitive value from the input into an output stream inside
+|*     the kernel: splice() into pipes, sendfile() into sockets. The
+|*     headers already written are flushed first. Only values of
+|*     IO_SPLICE_MIN bytes or more are worth it, and not under IO_DIRECT,
+|*     whose offsets must be aligned. The input is left after the bytes
+|*     moved; the rest, if any, is for the caller to copy.
+|* 
+|* Return:
+|*      Bytes moved, 0 when not possible
+|*     -1: Error writing
+|* 
+|* Modifications:
+|* 20261018    Initial version
+|* 
+****************************************************************************/
+long io_splice(
+    FILE*               file,           /* Input file */
+    FILE*               outfile,        /* Output file */
+    long                from,           /* Position of the value in the input */
+    long                len             /* Size of the value */
+)
+{
+#ifdef IO_HAVE_SPLICE
+    io_file*            in=io_find(file);
+    io_file*            out=io_find(outfile);
+    loff_t              splice_off;
+    off_t               send_off;
+    ssize_t             n;
+    long                done=0;
+
+
+    if ( !io.splice || io.mode == IO_DIRECT || len < IO_SPLICE_MIN || !in || !out || !out->stream )
+        return 0;
+
+    if ( write_flush(outfile) != 0 )
+    {
+        fprintf(stderr, "Error writing the output: %s\n", strerror(errno));
+        return -1;
+    }
+
+    while (done < len)
+    {
+        if (out->pipe)
+        {
+            splice_off=from+done;
+            n=splice(in->fd, &splice_off, out->fd, NULL, len-done, SPLICE_F_MOVE|SPLICE_F_MORE);
+        }
+        else
+        {
+            send_off=from+done;
+            n=sendfile(out->fd, in->fd, &send_off, len-done);
+        }
+
+        if (n == 0)
+        {
+            /* End of the input: found by the caller */
+            break;
+        }
+
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            if ( done == 0 && ( errno == EINVAL || errno == ENOSYS ) )
+            {
+                /* Not for these files: copy as usual from now on */
+                io.splice=FALSE;
+                break;
+            }
+
+            fprintf(stderr, "Error moving the value at position %ld to the output: %s\n", from, strerror(errno));
+            return -1;
+        }
+
+        done+=n;
+    }
+
+    if ( fseek(file, from+done, SEEK_SET) != 0 )
+    {
+        fprintf(stderr, "Error moving to the position %ld of the file: %s\n", from+done, strerror(errno));
+        return -1;
+    }
+
+    return done;
+#else
+    return 0;
+#endif
+}
+
+#ifdef IO_HAVE_DIRECT
+
+/****************************************************************************
+|* 
+|* Function: io_direct_read
+|* 
+|* Description; 
+|* 
+|*     fopencookie() read for IO_DIRECT. Whole aligned blocks are read into
+|*     the aligned buffer and served from there.
+|* 
+|* Return:
+|*      Bytes read, 0 at the end of the file
+|*     -1: Error
+|* 
+|* Modifications:
+|* 20261018    Initial version
+|* 
+****************************************************************************/
+ssize_t io_direct_read(
+    void*               cookie,         /* io_file */
+    char*               buf,            /* Where to read */
+    size_t              size            /* Bytes wanted */
+)
+{
+    io_file*            f=(io_file*)cookie;
+    size_t              done=0, n;
+    ssize_t             r;
+
+    while (done < size)
+    {
+        if ( f->buf_off < 0 || f->off < f->buf_off || f->off >= f->buf_off + (off_t)f->buf_len )
+        {
+            /* 1. Load the block where we are */
+
+            if ( io_direct_flush(f) != 0 )
+                return -1;
+
+            f->buf_off=f->off & ~(off_t)(IO_ALIGN-1);
+
+            if ( ( r=pread(f->fd, f->buf, io.bufsize, f->buf_off) ) < 0 )
+                return -1;
+
+            f->buf_len=(size_t)r;
+
+            if ( f->off >= f->buf_off + r )
+                break;
+        }
+
+        /* 2. Serve from the buffer */
+
+        n=(size_t)(f->buf_off + (off_t)f->buf_len - f->off);
+        if (n > size - done)
+            n=size - done;
+
+        memcpy(buf+done, f->buf + (f->off - f->buf_off), n);
+        done+=n;
+        f->off+=n;
+    }
+
+    return (ssize_t)done;
+}
+
+
+/****************************************************************************
+|* 
+|* Function: io_direct_write
+|* 
+|* Description; 
+|* 
+|*     fopencookie() write for IO_DIRECT. Data is gathered in the aligned
+|*     buffer, which is written each time it gets full.
+|* 
+|* Return:
+|*      Bytes written
+|*      0: Error
+|* 
+|* Modifications:
+|* 20261018    Initial version
+|* 
+****************************************************************************/
+ssize_t io_direct_write(
+    void*               cookie,         /* io_file */
+    const char*         buf,            /* What to write */
+    size_t              size            /* Bytes to write */
+)
+{
+    io_file*            f=(io_file*)cookie;
+    size_t              done=0, n;
+    ssize_t             r;
+
+    while (done < size)
+    {
+        if ( f->buf_off < 0 || f->off < f->buf_off || f->off >= f->buf_off + (off_t)io.bufsize )
+        {
+            /* 1. Move the buffer to the block where we are, keeping what the file already has */
+
+            if ( io_direct_flush(f) != 0 )
+                return 0;
+
+            f->buf_off=f->off & ~(off_t)(IO_ALIGN-1);
+            f->buf_len=0;
+
+            if ( f->buf_off < f->end )
+            {
+                if ( ( r=pread(f->fd, f->buf, io.bufsize, f->buf_off) ) < 0 )
+                    return 0;
+                f->buf_len=(size_t)r;
+            }
+        }
+
+        /* 2. Copy into the buffer */
+
+        n=(size_t)(f->buf_off + (off_t)io.bufsize - f->off);
+        if (n > size - done)
+            n=size - done;
+
+        memcpy(f->buf + (f->off - f->buf_off), buf+done, n);
+        done+=n;
+        f->off+=n;
+        f->dirty=TRUE;
+
+        if ( (size_t)(f->off - f->buf_off) > f->buf_len )
+            f->buf_len=(size_t)(f->off - f->buf_off);
+        if ( f->off > f->end )
+            f->end=f->off;
+
+
+        /* 3. Write it when full */
+
+        if ( f->buf_len == io.bufsize && io_direct_flush(f) != 0 )
+            return 0;
+    }
+
+    return (ssize_t)done;
+}
+
+
+/****************************************************************************
+|* 
+|* Function: io_direct_flush
+|* 
+|* Description; 
+|* 
+|*     Writes the buffer of IO_DIRECT if modified. O_DIRECT only accepts
+|*     whole blocks, so an incomplete last block is written without it;
+|*     the buffer is kept, and the block will be written again when full.
+|* 
+|* Return:
+|*      0: Successful
+|*     -1: Error
+|* 
+|* Modifications:
+|* 20261018    Initial version
+|* 
+****************************************************************************/
+int io_direct_flush(
+    io_file*            f               /* io_file */
+)
+{
+    size_t              full, tail;
+    int                 flags;
+
+    if (!f->dirty)
+        return 0;
+
+    full=f->buf_len & ~(size_t)(IO_ALIGN-1);
+    tail=f->buf_len - full;
+
+    if ( full && pwrite(f->fd, f->buf, full, f->buf_off) != (ssize_t)full )
+        return -1;
+
+    if (tail)
+    {
+        if ( ( flags=fcntl(f->fd, F_GETFL) ) == -1 || fcntl(f->fd, F_SETFL, flags & ~O_DIRECT) == -1 )
+            return -1;
+
+        if ( pwrite(f->fd, f->buf+full, tail, f->buf_off+full) != (ssize_t)tail )
+            return -1;
+
+        if ( fcntl(f->fd, F_SETFL, flags) == -1 )
+            return -1;
+    }
+
+    f->dirty=FALSE;
+
+    PROBE2(flush, f->fd, f->buf_off + (off_t)f->buf_len);
+
+    return 0;
+}
+
+
+/****************************************************************************
+|* 
+|* Function: io_direct_seek
+|* 
+|* Description; 
+|* 
+|*     fopencookie() seek for IO_DIRECT
+|* 
+|* Return:
+|*      0: Successful
+|*     -1: Error
+|* 
+|* Modifications:
+|* 20261018    Initial version
+|* 
+****************************************************************************/
+int io_direct_seek(
+    void*               cookie,         /* io_file */
+    off64_t*            offset,         /* Where to go. Returns the new position */
+    int                 whence          /* SEEK_SET, SEEK_CUR or SEEK_END */
+)
+{
+    io_file*            f=(io_file*)cookie;
+    off64_t             off;
+
+    switch (whence)
+    {
+        case SEEK_SET: off=*offset;             break;
+        case SEEK_CUR: off=f->off + *offset;    break;
+        case SEEK_END: off=f->end + *offset;    break;
+        default:       return -1;
+    }
+
+    if (off < 0)
+        return -1;
+
+    f->off=off;
+    *offset=off;
+
+    return 0;
+}
+
+
+/****************************************************************************
+|* 
+|* Function: io_direct_close
+|* 
+|* Description; 
+|* 
+|*     fopencookie() close for IO_DIRECT
+|* 
+|* Return:
+|*      0: Successful
+|*     -1: Error
+|* 
+|* Modifications:
+|* 20261018    Initial version
+|* 
+****************************************************************************/
+int io_direct_close(
+    void*               cookie          /* io_file */
+)
+{
+    io_file*            f=(io_file*)cookie;
+    int                 ret;
+
+    ret=io_direct_flush(f);
+
+    if ( close(f->fd) != 0 )
+        ret=-1;
+
+    return ret;
+}
+
+#endif
+
+
+/****************************************************************************
+|* 
+|* Function: schema_lookup
+|* 
+|* Description; 
+|* 
+|*     Finds an item in the tables of the schema
+|* 
+|* Return:
+|*      Entry of the table
+|*      NULL: No schema or tag not known
+|* 
+|* Modifications:
+|* 20261018    Initial version
+|* 
+****************************************************************************/
+const schema_tag* schema_lookup(
+    const asn1item*     a_item          /* Item decoded */
+)
+{
+    if ( !schema || a_item->class != CLASS_APPLICATION || a_item->tag >= schema->size || !schema->tags[a_item->tag].name )
+        return NULL;
+
+    return &schema->tags[a_item->tag];
+}
+
+
+/****************************************************************************
+|* 
+|* Function: schema_check
+|* 
+|* Description; 
+|* 
+|*     Checks an item against the schema: the top level items must start
+|*     a file and nothing else can, and the known items must be primitive
+|*     or constructed as the specification says. Keeps also the count of
+|*     records.
+|* 
+|* Return:
+|*      0: Successful
+|*     -1: Item not expected
+|* 
+|* Modifications:
+|* 20261018    Initial version
+|* 
+****************************************************************************/
+int schema_check(
+    const asn1item*     a_item,         /* Item decoded */
+    const schema_tag*   s_tag           /* Its entry in the schema. NULL: not known */
+)
+{
+    char                tag_h[9];
+
+
+    /* 1. Where the file starts */
+
+    if ( !depth && ( !s_tag || s_tag->kind != SCHEMA_ROOT ) )
+    {
+        bcd_2_hexa(tag_h, a_item->tag_x, a_item->tag_l);
+        fprintf(stderr, "Not a %s file: found tag %s at position: %ld\n", schema->name, tag_h, pos);
+        return -1;
+    }
+
+    if ( depth && s_tag && s_tag->kind == SCHEMA_ROOT )
+    {
+        fprintf(stderr, "Found %s inside another item at position: %ld\n", s_tag->name, pos);
+        return -1;
+    }
+
+
+    /* 2. Primitive or constructed */
+
+    if ( s_tag && s_tag->pc != a_item->pc )
+    {
+        fprintf(stderr, "Found %s %s at position: %ld\n", s_tag->name, a_item->pc ? "constructed" : "primitive", pos);
+        return -1;
+    }
+
+
+    /* 3. Records */
+
+    if ( records_depth >= 0 && depth == records_depth+1 )
+        record_no++;
+
+    if ( s_tag && s_tag->kind == SCHEMA_RECORDS )
+        records_depth=depth;
+    else if ( records_depth >= depth )
+        records_depth=-1;
+
+    return 0;
+}
+
+
+/****************************************************************************
+|* 
+|* Function: multi_convert
+|* 
+|* Description; 
+|* 
+|*     Converts a file made of several top level items, such as a bundle of
+|*     concatenated TAP or RAP files, handing each item to a worker process
+|*     with its own list of indefinite length. Up to 'jobs' workers run at
+|*     once.
+|*
+|*     The items are measured first, without keeping their lists, which
+|*     gives also where each one goes in the output: the workers can then
+|*     write into the same output file, or into outfilename.N with -x.
+|* 
+|* Return:
+|*      0: Successful
+|*     -1: Error decoding
+|* 
+|* Modifications:
+|* 20261018    Initial version
+|* 
+****************************************************************************/
+int multi_convert(
+    FILE*               file,           /* File handler to decode */
+    const char*         inFilename,     /* Input file, opened again by each worker */
+    const char*         outFilename     /* Output file */
+)
+{
+    top_item*           t_items=NULL, *t_tmp;
+    int                 n=0, n_max=0, next=0, running=0, failed=FALSE, status;
+    long                len, len_def, out_len=0;
+    FILE*               outfile;
+    pid_t               pid;
+
+
+    /* 1. Find the top level items. \0\0 at the top level is just padding between them */
+
+    PROBE2(pass__start, 0, pos);
+
+    while (pos < in_size)
+    {
+        if (n == n_max)
+        {
+            n_max=n_max ? n_max*2 : 64;
+
+            if ( ( t_tmp=(top_item*)realloc(t_items, n_max*sizeof(top_item)) ) == NULL )
+            {
+                fprintf(stderr, "Problems allocating memory\n");
+                free(t_items);
+                return -1;
+            }
+            t_items=t_tmp;
+        }
+
+        t_items[n].pos=pos;
+        t_items[n].out_pos=out_len;
+
+        if ( collect_indef(file, -1, NULL, &len, &len_def) == -1 )
+        {
+            free(t_items);
+            return -1;
+        }
+
+        if (!len_def)
+        {
+            /* Padding, more items may follow */
+            continue;
+        }
+
+        out_len+=len_def;
+        n++;
+    }
+
+    PROBE3(pass__end, 0, pos, out_len);
+
+
+    /* 2. One output file for all: create it */
+
+    if (!split)
+    {
+        if ( ( outfile=io_open(outFilename, "wb") ) == NULL || io_close(outfile) != 0 )
+        {
+            fprintf(stderr, "Cannot open file %s\n", outFilename);
+            free(t_items);
+            return -1;
+        }
+    }
+
+
+    /* 3. Run the workers */
+
+    fflush(NULL);
+
+    while ( ( next < n && !failed ) || running )
+    {
+        if ( next < n && !failed && running < jobs )
+        {
+            /* 3.1. Start one more */
+
+            if ( ( pid=fork() ) == -1 )
+            {
+                fprintf(stderr, "Cannot start a worker: %s\n", strerror(errno));
+                failed=TRUE;
+                continue;
+            }
+
+            if (!pid)
+                _exit(convert_item(inFilename, outFilename, next+1, &t_items[next]) == -1 ? 1 : 0);
+
+            next++;
+            running++;
+        }
+        else
+        {
+            /* 3.2. Wait until one finishes */
+
+            if ( wait(&status) == -1 )
+            {
+                fprintf(stderr, "Error waiting for the workers: %s\n", strerror(errno));
+                free(t_items);
+                return -1;
+            }
+
+            running--;
+
+            if ( !WIFEXITED(status) || WEXITSTATUS(status) != 0 )
+                failed=TRUE;
+        }
+    }
+
+    free(t_items);
+
+    return failed ? -1 : 0;
+}
+
+
+/****************************************************************************
+|* 
+|* Function: convert_item
+|* 
+|* Description; 
+|* 
+|*     Worker of multi_convert: converts one top level item with both
+|*     passes, as if it were the whole file
+|* 
+|* Return:
+|*      0: Successful
+|*     -1: Error decoding
+|* 
+|* Modifications:
+|* 20261018    Initial version
+|* 
+****************************************************************************/
+int convert_item(
+    const char*         inFilename,     /* Input file */
+    const char*         outFilename,    /* Output file */
+    int                 n,              /* Number of the item, from 1 */
+    const top_item*     t_item          /* Where it is */
+)
+{
+    FILE*               file, *outfile;
+    char*               itemFilename=NULL;
+    indef_len_item*     len_list, *len_tail;
+    long                len_tmp, len_def_tmp;
+    int                 ret=-1;
+
+
+    /* 1. Open the files at the item */
+
+    if ( ( file=io_open(inFilename, "rb") ) == NULL || fseek(file, t_item->pos, SEEK_SET) != 0 )
+    {
+        fprintf(stderr, "Cannot open file %s\n", inFilename);
+        return -1;
+    }
+
+    if (split)
+    {
+        if ( ( itemFilename=(char*)malloc(strlen(outFilename)+12) ) == NULL )
+        {
+            fprintf(stderr, "Problems allocating memory\n");
+            return -1;
+        }
+        sprintf(itemFilename, "%s.%d", outFilename, n);
+
+        outfile=io_open(itemFilename, "wb");
+        out_pos=0;
+    }
+    else
+    {
+        if ( ( outfile=io_open(outFilename, "r+b") ) != NULL && fseek(outfile, t_item->out_pos, SEEK_SET) != 0 )
+        {
+            io_close(outfile);
+            outfile=NULL;
+        }
+        out_pos=t_item->out_pos;
+    }
+
+    if (outfile == NULL)
+    {
+        fprintf(stderr, "Cannot open file %s\n", itemFilename ? itemFilename : outFilename);
+        return -1;
+    }
+
+
+    /* 2. Find all indefinite lengths of the item */
+
+    if ( ( len_list=(indef_len_item*)malloc(sizeof(indef_len_item)) ) == NULL )
+    {
+        fprintf(stderr, "Problems allocating memory\n");
+        return -1;
+    }
+    memset(len_list, 0x00, sizeof(indef_len_item));
+
+    len_tail=len_list;
+    pos=t_item->pos;
+    items=0;
+
+    PROBE2(pass__start, 1, pos);
+
+    if ( collect_indef(file, -1, &len_tail, &len_tmp, &len_def_tmp) != -1 )
+    {
+        PROBE3(pass__end, 1, pos, 0);
+
+
+        /* 3. Decode and prints the item */
+
+        pos=t_item->pos;
+        records_depth=-1;
+        record_no=0;
+
+        PROBE2(pass__start, 2, pos);
+
+        if ( fseek(file, pos, SEEK_SET) == 0 && write_tap(file, outfile, 1, &len_list) != -1 )
+            ret=0;
+
+        PROBE3(pass__end, 2, pos, out_pos);
+    }
+
+
+    /* 4. Closing and End. */
+
+    free(len_list);
+    free(itemFilename);
+
+    io_close(file);
+
+    if ( ret == 0 && write_flush(outfile) != 0 )
+    {
+        fprintf(stderr, "Error writing file %s: %s\n", outFilename, strerror(errno));
+        ret=-1;
+    }
+
+    if ( io_close(outfile) != 0 )
+    {
+        fprintf(stderr, "Error writing file %s: %s\n", outFilename, strerror(errno));
+        ret=-1;
+    }
+
+    return ret;
+}
+
+/****************************************************************************
+|* 
+|* Function: sha256_init
+|* 
+|* Description; 
+|* 
+|*     Starts a SHA-256 (FIPS 180-4). The cache needs a hash whose
+|*     collisions cannot be made on purpose: the files come from partners.
+|* 
+|* Return:
+|*      void
+|* 
+|* Modifications:
+|* 20261018    Initial version
+|* 
+****************************************************************************/
+void sha256_init(
+    sha256_ctx*         ctx             /* Hash to start */
+)
+{
+    static const uint32_t   h0[8]=
+    {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    memcpy(ctx->state, h0, sizeof(h0));
+    ctx->len=0;
+    ctx->used=0;
+}
+
+
+/****************************************************************************
+|* 
+|* Function: sha256_block
+|* 
+|* Description; 
+|* 
+|*     Adds a block of 64 bytes to the hash
+|* 
+|* Return:
+|*      void
+|* 
+|* Modifications:
+|* 20261018    Initial version
+|* 
+****************************************************************************/
+void sha256_block(
+    sha256_ctx*         ctx,            /* Hash */
+    const uchar*        block           /* 64 bytes */
+)
+{
+    static const uint32_t   k[64]=
+    {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+    };
+    uint32_t            w[64], v[8], t1, t2;
+    int                 i;
+
+    #define SHA_ROR(x, n)   ( ( (x) >> (n) ) | ( (x) << (32-(n)) ) )
+
+
+    /* 1. Message schedule */
+
+    for (i=0;i<16;i++)
+        w[i]=( (uint32_t)block[4*i] << 24 ) | ( (uint32_t)block[4*i+1] << 16 ) | ( (uint32_t)block[4*i+2] << 8 ) | block[4*i+3];
+
+    for (i=16;i<64;i++)
+        w[i]=w[i-16] + ( SHA_ROR(w[i-15], 7) ^ SHA_ROR(w[i-15], 18) ^ ( w[i-15] >> 3 ) )
+            + w[i-7] + ( SHA_ROR(w[i-2], 17) ^ SHA_ROR(w[i-2], 19) ^ ( w[i-2] >> 10 ) );
+
+
+    /* 2. Rounds */
+
+    memcpy(v, ctx->state, sizeof(v));
+
+    for (i=0;i<64;i++)
+    {
+        t1=v[7] + ( SHA_ROR(v[4], 6) ^ SHA_ROR(v[4], 11) ^ SHA_ROR(v[4], 25) )
+            + ( ( v[4] & v[5] ) ^ ( ~v[4] & v[6] ) ) + k[i] + w[i];
+        t2=( SHA_ROR(v[0], 2) ^ SHA_ROR(v[0], 13) ^ SHA_ROR(v[0], 22) )
+            + ( ( v[0] & v[1] ) ^ ( v[0] & v[2] ) ^ ( v[1] & v[2] ) );
+
+        v[7]=v[6];
+        v[6]=v[5];
+        v[5]=v[4];
+        v[4]=v[3] + t1;
+        v[3]=v[2];
+        v[2]=v[1];
+        v[1]=v[0];
+        v[0]=t1 + t2;
+    }
+
+    for (i=0;i<8;i++)
+        ctx->state[i]+=v[i];
+
+    #undef SHA_ROR
+}
+
+
+/****************************************************************************
+|* 
+|* Function: sha256_update
+|* 
+|* Description; 
+|* 
+|*     Adds bytes to the hash
+|* 
+|* Return:
+|*      void
+|* 
+|* Modifications:
+|* 20261018    Initial version
+|* 
+****************************************************************************/
+void sha256_update(
+    sha256_ctx*         ctx,            /* Hash */
+    const uchar*        buf,            /* Bytes to add */
+    size_t              len             /* Number of bytes */
+)
+{
+    size_t              n;
+
+    ctx->len+=len;
+
+    while (len > 0)
+    {
+        if ( !ctx->used && len >= 64 )
+        {
+            /* Whole blocks straight from the caller */
+            sha256_block(ctx, buf);
+            buf+=64;
+            len-=64;
+            continue;
+        }
+
+        n=64 - ctx->used < len ? 64 - ctx->used : len;
+        memcpy(ctx->block + ctx->used, buf, n);
+        ctx->used+=n;
+        buf+=n;
+        len-=n;
+
+        if (ctx->used == 64)
+        {
+            sha256_block(ctx, ctx->block);
+            ctx->used=0;
+        }
+    }
+}
+
+
+/****************************************************************************
+|* 
+|* Function: sha256_final
+|* 
+|* Description; 
+|* 
+|*     Pads the hash and gives it as 64 hexadecimal digits
+|* 
+|* Return:
+|*      void
+|* 
+|* Modifications:
+|* 20261018    Initial version
+|* 
+****************************************************************************/
+void sha256_final(
+    sha256_ctx*         ctx,            /* Hash */
+    char*               hex             /* 65 bytes */
+)
+{
+    unsigned long long  bits=ctx->len*8;
+    uchar               pad[72];
+    size_t              n;
+    int                 i;
+
+    n=( ctx->used < 56 ? 56 : 120 ) - ctx->used;
+
+    memset(pad, 0x00, sizeof(pad));
+    pad[0]=0x80;
+
+    for (i=0;i<8;i++)
+        pad[n+i]=(uchar)( bits >> (8*(7-i)) );
+
+    sha256_update(ctx, pad, n+8);
+
+    for (i=0;i<8;i++)
+        sprintf(hex+8*i, "%08x", (unsigned int)ctx->state[i]);
+}
+
+
+/****************************************************************************
+|* 
+|* Function: cache_lookup
+|* 
+|* Description; 
+|* 
+|*     Names the entry of the input file in the cache after a SHA-256 of
+|*     its contents, its size and the options which change the output or
+|*     whether it is accepted at all, and serves the output from there if
+|*     the entry exists. The input is left at the beginning.
+|* 
+|* Return:
+|*      TRUE: Output taken from the cache
+|*     FALSE: Not in the cache, it has to be converted
+|*        -1: Error reading the input
+|* 
+|* Modifications:
+|* 20261018    Initial version
+|* 
+****************************************************************************/
+int cache_lookup(
+    FILE*               file,           /* Input file */
+    const char*         outFilename     /* Output file */
+)
+{
+    sha256_ctx          ctx;
+    char                hash[65];
+    size_t              n;
+    long                done=0;
+
+
+    /* 1. Hash the input */
+
+    sha256_init(&ctx);
+
+    while ( ( n=fread(copy_buf, 1, IO_COPY_BUF, file) ) > 0 )
+    {
+        sha256_update(&ctx, copy_buf, n);
+        done+=n;
+
+        io_advise(file, done);
+    }
+
+    if ( ferror(file) || done != in_size || fseek(file, 0, SEEK_SET) != 0 )
+    {
+        fprintf(stderr, "Error reading the file: %s\n", strerror(errno));
+        return -1;
+    }
+
+
+    sha256_final(&ctx, hash);
+
+
+    /* 2. Name the entry: -m gives the same output as -a. -s, -D and -N decide whether it converts.
+          Entries of other versions are never served, eviction takes care of them */
+
+    if ( ( cache.entry=(char*)malloc(strlen(cache.dir)+160) ) == NULL )
+    {
+        fprintf(stderr, "Problems allocating memory\n");
+        cache.dir=NULL;
+        return FALSE;
+    }
+    sprintf(cache.entry, "%s/v%d-%s-%lx-%c-%s-D%d-N%ld.der", cache.dir, CACHE_VERSION, hash, in_size, (all_file || jobs) ? 'a' : '1',
+            schema ? schema->name : "any", max_depth, max_items);
+
+
+    /* 3. Serve it if it is there, marking it as just used */
+
+    if ( access(cache.entry, R_OK) != 0 )
+        return FALSE;
+
+    if ( cache_copy(cache.entry, outFilename, cache.link, FALSE) == -1 )
+    {
+        fprintf(stderr, "Cannot take %s from the cache, converting it\n", outFilename);
+        return FALSE;
+    }
+
+    utimensat(AT_FDCWD, cache.entry, NULL, 0);
+
+    return TRUE;
+}
+
+
+/****************************************************************************
+|* 
+|* Function: cache_store
+|* 
+|* Description; 
+|* 
+|*     Copies a converted output into its entry of the cache, under a
+|*     temporary name renamed once it is on disk, so that a crash never
+|*     leaves a partial entry. A failure only costs the next conversion.
+|* 
+|* Return:
+|*      void
+|* 
+|* Modifications:
+|* 20261018    Initial version
+|* 
+****************************************************************************/
+void cache_store(
+    const char*         outFilename     /* Output file just converted */
+)
+{
+    char*               tmpFilename;
+
+
+    if (!cache.entry)
+        return;
+
+    if ( ( tmpFilename=(char*)malloc(strlen(cache.entry)+16) ) == NULL )
+    {
+        fprintf(stderr, "Problems allocating memory\n");
+        return;
+    }
+    sprintf(tmpFilename, "%s.%d.tmp", cache.entry, (int)getpid());
+
+    if ( cache_copy(outFilename, tmpFilename, FALSE, TRUE) == -1 || rename(tmpFilename, cache.entry) != 0 )
+    {
+        fprintf(stderr, "Cannot keep %s in the cache %s: %s\n", outFilename, cache.dir, strerror(errno));
+        remove(tmpFilename);
+    }
+    else
+    {
+        cache_evict();
+    }
+
+    free(tmpFilename);
+}
+
+
+/****************************************************************************
+|* 
+|* Function: cache_copy
+|* 
+|* Description; 
+|* 
+|*     Copies a file for the cache, the cheapest way the file system allows:
+|*     a hard link if asked for, then a reflink (shared blocks, copied on
+|*     write), then reading and writing. dst can be a stream as in
+|*     io_is_stream.
+|* 
+|* Return:
+|*      0: Successful
+|*     -1: Error
+|* 
+|* Modifications:
+|* 20261018    Initial version
+|* 
+****************************************************************************/
+int cache_copy(
+    const char*         src,            /* File to copy */
+    const char*         dst,            /* Where to copy it */
+    int                 hardlink,       /* A hard link is enough */
+    int                 durable         /* On disk before returning */
+)
+{
+    int                 fd_in, fd_out, ret=0, stream=io_is_stream(dst);
+    ssize_t             n, w, done;
+
+
+    /* 1. Hard link */
+
+    if ( hardlink && !stream )
+    {
+        remove(dst);
+
+        if ( link(src, dst) == 0 )
+            return 0;
+    }
+
+
+    /* 2. Reflink, or read and write */
+
+    if ( ( fd_in=open(src, O_RDONLY) ) == -1 )
+        return -1;
+
+    if (!stream)
+        io_unshare(dst);
+
+    if ( ( fd_out=stream ? io_connect(dst) : open(dst, O_WRONLY|O_CREAT|O_TRUNC, 0666) ) == -1 )
+    {
+        close(fd_in);
+        return -1;
+    }
+
+#ifdef FICLONE
+    if ( ioctl(fd_out, FICLONE, fd_in) != 0 )
+#endif
+    {
+        while ( ret == 0 && ( n=read(fd_in, copy_buf, IO_COPY_BUF) ) != 0 )
+        {
+            if ( n == -1 )
+            {
+                if ( errno != EINTR )
+                    ret=-1;
+                continue;
+            }
+
+            for (done=0; done < n; done+=w)
+            {
+                if ( ( w=write(fd_out, copy_buf+done, n-done) ) == -1 )
+                {
+                    if ( errno != EINTR )
+                    {
+                        ret=-1;
+                        break;
+                    }
+                    w=0;
+                }
+            }
+        }
+    }
+
+    if ( ret == 0 && durable && fsync(fd_out) != 0 )
+        ret=-1;
+
+    close(fd_in);
+
+    if ( close(fd_out) != 0 )
+        ret=-1;
+
+    return ret;
+}
+
+
+/****************************************************************************
+|* 
+|* Function: cache_evict
+|* 
+|* Description; 
+|* 
+|*     Removes the least recently used entries of the cache until it fits
+|*     in cache.max bytes. The modification time of an entry is when it
+|*     was last stored or served.
+|*
+|*     Entries being stored (*.tmp) count towards the size too. Those not
+|*     written for CACHE_TMP_GRACE seconds were left by a run which was
+|*     killed, and are removed.
+|* 
+|* Return:
+|*      void
+|* 
+|* Modifications:
+|* 20261018    Initial version
+|* 
+****************************************************************************/
+void cache_evict(void)
+{
+    typedef struct { char* name; struct timespec used; long size; } cache_entry;
+
+    DIR*                dir;
+    struct dirent*      de;
+    struct stat         st;
+    cache_entry*        entries=NULL, *e_tmp, e_swap;
+    int                 n=0, n_max=0, i, j, oldest;
+    long                total=0;
+    size_t              len;
+    char*               name;
+    int                 stored;
+    time_t              now=time(NULL);
+
+
+    /* 1. List the entries */
+
+    if ( ( dir=opendir(cache.dir) ) == NULL )
+        return;
+
+    while ( ( de=readdir(dir) ) != NULL )
+    {
+        len=strlen(de->d_name);
+
+        if ( len > 4 && strcmp(de->d_name+len-4, ".der") == 0 )
+            stored=TRUE;
+        else if ( len > 4 && strcmp(de->d_name+len-4, ".tmp") == 0 )
+            stored=FALSE;
+        else
+            continue;
+
+        if ( ( name=(char*)malloc(strlen(cache.dir)+len+2) ) == NULL )
+            break;
+        sprintf(name, "%s/%s", cache.dir, de->d_name);
+
+        if ( lstat(name, &st) != 0 || !S_ISREG(st.st_mode) )
+        {
+            free(name);
+            continue;
+        }
+
+        if (!stored)
+        {
+            /* 1.1. Being stored, or left behind */
+
+            if ( now - st.st_mtime < CACHE_TMP_GRACE || remove(name) != 0 )
+                total+=(long)st.st_size;
+
+            free(name);
+            continue;
+        }
+
+        if (n == n_max)
+        {
+            n_max=n_max ? n_max*2 : 64;
+
+            if ( ( e_tmp=(cache_entry*)realloc(entries, n_max*sizeof(cache_entry)) ) == NULL )
+            {
+                free(name);
+                break;
+            }
+            entries=e_tmp;
+        }
+
+        entries[n].name=name;
+        entries[n].used=st.st_mtim;
+        entries[n].size=(long)st.st_size;
+        total+=entries[n].size;
+        n++;
+    }
+
+    closedir(dir);
+
+
+    /* 2. Remove the oldest until it fits */
+
+    for (i=0; i<n && total > cache.max; i++)
+    {
+        for (oldest=i, j=i+1; j<n; j++)
+        {
+            if ( entries[j].used.tv_sec < entries[oldest].used.tv_sec ||
+                 ( entries[j].used.tv_sec == entries[oldest].used.tv_sec && entries[j].used.tv_nsec < entries[oldest].used.tv_nsec ) )
+                oldest=j;
+        }
+
+        e_swap=entries[i];
+        entries[i]=entries[oldest];
+        entries[oldest]=e_swap;
+
+        if ( remove(entries[i].name) == 0 )
+            total-=entries[i].size;
+    }
+
+    for (i=0; i<n; i++)
+        free(entries[i].name);
+    free(entries);
+}
@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+#
+# Generates the pathological inputs run by run_pathological.sh into the
+# directory given, together with the expected output of those which must
+# convert.
+#
+#   deep_over.ber       more levels of nesting than the default -D
+#   tag_big.ber         tag of more bytes than accepted
+#   len_8.ber           length of 8 octets
+#   len_9.ber           length of 9 octets
+#   overrun_eof.ber     definite length beyond the end of the file
+#   overrun_parent.ber  definite length beyond the end of its parent
+#   padded_bad.ber      data after an odd number of padding bytes
+#   empty_1m.ber        1M empty items of indefinite length
+#   deep_ok.ber         10000 levels of indefinite length, within -D 10000
+#   nonminimal.ber      top level items whose definite lengths are longer
+#                       than needed, written again in as few bytes as
+#                       possible: the same with -a and -m
+#   padded.ber          bundle of items with zero padding between them and
+#                       after the last one: the same with -a and -m
+#
+
+import os
+import sys
+
+EMPTY_ITEMS = 1000000
+DEEP_OK = 10000
+DEEP_OVER = 65
+
+
+def length(n):
+    """Minimal definite length."""
+    if n < 0x80:
+        return bytes([n])
+    b = n.to_bytes((n.bit_length() + 7) // 8, 'big')
+    return bytes([0x80 | len(b)]) + b
+
+
+def write(path, data):
+    with open(path, 'wb') as f:
+        f.write(data)
+
+
+def main(outdir):
+    os.makedirs(outdir, exist_ok=True)
+    out = lambda name: os.path.join(outdir, name)
+
+    # 1. Rejected
+
+    write(out('deep_over.ber'), b'\x30\x80' * DEEP_OVER + b'\x04\x01\x01' + b'\x00\x00' * DEEP_OVER)
+    write(out('tag_big.ber'), b'\x7f\xff\xff\xff\xff\x7f\x01\x01')
+    write(out('len_8.ber'), b'\x04\x88' + b'\x00' * 7 + b'\x01' + b'\x01')
+    write(out('len_9.ber'), b'\x04\x89' + b'\x00' * 8 + b'\x01' + b'\x01')
+    write(out('overrun_eof.ber'), b'\x04\x05\x01\x02')
+    write(out('overrun_parent.ber'), b'\x30\x03\x04\x05\x01\x02\x03\x04\x05')
+    write(out('padded_bad.ber'), b'\x61\x80\x04\x01\x71\x00\x00' + b'\x00' * 3 + b'\x61\x03\x04\x01\x72')
+
+    # 2. Converted, within time bounds
+
+    write(out('empty_1m.ber'), b'\x30\x80' + b'\x30\x80\x00\x00' * EMPTY_ITEMS + b'\x00\x00')
+    body = b'\x30\x00' * EMPTY_ITEMS
+    write(out('empty_1m.der'), b'\x30' + length(len(body)) + body)
+
+    write(out('deep_ok.ber'), b'\x30\x80' * (DEEP_OK - 1) + b'\x04\x01\x01' + b'\x00\x00' * (DEEP_OK - 1))
+    der = b'\x04\x01\x01'
+    for _ in range(DEEP_OK - 1):
+        der = b'\x30' + length(len(der)) + der
+    write(out('deep_ok.der'), der)
+
+    # 3. Lengths written again
+
+    write(out('nonminimal.ber'),
+          b'\x61\x80\x62\x81\x03\x04\x01\x71\x00\x00' +
+          b'\x61\x81\x05\x04\x01\x72\x04\x00' +
+          b'\x30\x0c\x31\x0a\x32\x81\x03\x04\x01\x73\x32\x80\x00\x00')
+    write(out('nonminimal.der'),
+          b'\x61\x05\x62\x03\x04\x01\x71' +
+          b'\x61\x05\x04\x01\x72\x04\x00' +
+          b'\x30\x09\x31\x07\x32\x03\x04\x01\x73\x32\x00')
+
+    # 4. Padding between the items of a bundle
+
+    write(out('padded.ber'),
+          b'\x61\x80\x04\x01\x71\x00\x00' + b'\x00' * 4 +
+          b'\x61\x80\x04\x01\x72\x00\x00' + b'\x00' * 2 +
+          b'\x61\x03\x04\x01\x73' + b'\x00' * 3)
+    write(out('padded.der'), b'\x61\x03\x04\x01\x71' + b'\x61\x03\x04\x01\x72' + b'\x61\x03\x04\x01\x73')
+
+
+if __name__ == '__main__':
+    if len(sys.argv) != 2:
+        sys.exit('Usage: %s outdir' % sys.argv[0])
+    main(sys.argv[1])
@@ -0,0 +1,106 @@
+#!/bin/sh
+#
+# Runs indef2def over the files of gen_pathological.py: the malformed ones
+# must be rejected, the others converted as expected within a time bound,
+# so that decoding stays linear.
+#
+# Usage: run_pathological.sh indef2def workdir
+#
+# TIME_SCALE multiplies the time bounds, for slow machines (default 1).
+#
+
+BIN=$1
+DIR=$2
+TIME_SCALE=${TIME_SCALE:-1}
+fail=0
+
+if [ $# -ne 2 ]
+then
+    echo "Usage: $0 indef2def workdir" >&2
+    exit 2
+fi
+
+now_ms()
+{
+    echo $(( $(date +%s%N) / 1000000 ))
+}
+
+# reject name message [ options ]: must fail with this message
+reject()
+{
+    name=$1; msg=$2; shift 2
+
+    if "$BIN" "$@" "$DIR/$name.ber" "$DIR/$name.out" 2> "$DIR/$name.err"
+    then
+        echo "FAIL $name: accepted"
+        fail=1
+    elif ! grep -q "$msg" "$DIR/$name.err"
+    then
+        echo "FAIL $name: expected \"$msg\", got:"
+        cat "$DIR/$name.err"
+        fail=1
+    else
+        echo "ok   $name: rejected"
+    fi
+}
+
+# convert name limit_ms [ options ]: must give the expected output in time
+convert()
+{
+    name=$1; limit=$(( $2 * TIME_SCALE )); shift 2
+
+    start=$(now_ms)
+    "$BIN" "$@" "$DIR/$name.ber" "$DIR/$name.out"
+    rc=$?
+    elapsed=$(( $(now_ms) - start ))
+    size=$(wc -c < "$DIR/$name.ber")
+
+    if [ $rc -ne 0 ]
+    then
+        echo "FAIL $name: exit code $rc"
+        fail=1
+    elif ! cmp -s "$DIR/$name.out" "$DIR/$name.der"
+    then
+        echo "FAIL $name: wrong output"
+        fail=1
+    elif [ $elapsed -gt $limit ]
+    then
+        echo "FAIL $name: ${elapsed} ms, limit ${limit} ms"
+        fail=1
+    else
+        echo "ok   $name: ${elapsed} ms (limit ${limit} ms), $(( size / 1024 / (elapsed + 1) )) MB/s"
+    fi
+}
+
+
+# 1. Malformed or beyond the limits
+
+reject deep_over        "levels of nesting"
+reject deep_ok          "levels of nesting" -D 100
+reject tag_big          "tag bigger than"
+reject len_8            "size bigger than"
+reject len_9            "size bigger than"
+reject overrun_eof      "end of file too soon"
+reject overrun_parent   "does not match the definite length"
+reject padded_bad       "data after the padding" -a
+reject padded_bad       "data after the padding" -m 2
+
+
+# 2. Worst cases within the limits
+
+convert empty_1m        3000
+convert deep_ok         1000 -D 10000
+
+
+# 3. Lengths written again: the workers of -m must agree with -a
+
+convert nonminimal      1000 -a
+convert nonminimal      1000 -m 2
+
+
+# 4. Padding between the items of a bundle: none of them is left out
+
+convert padded          1000 -a
+convert padded          1000 -m 2
+
+exit $fail